@@ -1,6 +1,7 @@
 package main
 
 import (
+	"bufio"
 	"bytes"
 	"encoding/base64"
 	"encoding/binary"
@@ -14,8 +15,10 @@ import (
 	"math"
 	"os"
 	"strconv"
+	"strings"
 
 	"github.com/karalabe/hid"
+	"gitlab.com/NebulousLabs/Sia/crypto"
 	"gitlab.com/NebulousLabs/Sia/types"
 	"lukechampine.com/flagg"
 )
@@ -100,16 +103,23 @@ type apduFramer struct {
 }
 
 func (af *apduFramer) Exchange(apdu APDU) ([]byte, error) {
-	if len(apdu.Payload) > 255 {
-		panic("APDU payload cannot exceed 255 bytes")
+	if len(apdu.Payload) > math.MaxUint16 {
+		panic("APDU payload cannot exceed 65535 bytes")
 	}
 	af.hf.Reset()
-	data := append([]byte{
+	data := []byte{
 		apdu.CLA,
 		apdu.INS,
 		apdu.P1, apdu.P2,
 		byte(len(apdu.Payload)),
-	}, apdu.Payload...)
+	}
+	if len(apdu.Payload) > 255 {
+		// use an extended-length APDU: a zero byte, followed by a 2-byte
+		// length
+		data[4] = 0
+		data = append(data, byte(len(apdu.Payload)>>8), byte(len(apdu.Payload)))
+	}
+	data = append(data, apdu.Payload...)
 	if _, err := af.hf.Write(data); err != nil {
 		return nil, err
 	}
@@ -129,7 +139,31 @@ func (af *apduFramer) Exchange(apdu APDU) ([]byte, error) {
 }
 
 type Nano struct {
-	device *apduFramer
+	device     *apduFramer
+	maxPayload int
+	dictSlots  int
+
+	// If Summary is set, transactions sent by CalcTxnHash(es) and
+	// SignTxn(s) are reviewed on the device as totals, rather than one
+	// output at a time.
+	Summary bool
+
+	// If HashOnly is set, transactions sent by CalcTxnHash(es) are not
+	// reviewed on the device at all; only the final hash is displayed. It
+	// has no effect on SignTxn(s).
+	HashOnly bool
+
+	// If Compress is set, transactions are compressed before being sent to
+	// the device. This is worthwhile over slow links, such as Bluetooth.
+	Compress bool
+
+	// If OmitSigs is set, only the headers of the requested
+	// TransactionSignatures are sent to the device, rather than every
+	// signature in full. The device can't check the CoveredFields of the
+	// signatures, so it's up to the caller to ensure that they set
+	// WholeTransaction = true. (A signature that covers only part of the
+	// transaction is always sent as just the elements it covers.)
+	OmitSigs bool
 }
 
 type ErrCode uint16
@@ -141,6 +175,8 @@ func (c ErrCode) Error() string {
 const codeSuccess = 0x9000
 const codeUserRejected = 0x6985
 const codeInvalidParam = 0x6b01
+const codeImproperInit = 0x6b02
+const codeBadOffset = 0x6b03
 
 var errUserRejected = errors.New("user denied request")
 var errInvalidParam = errors.New("invalid request parameters")
@@ -179,30 +215,94 @@ const (
 	cmdSignHash     = 0x04
 	cmdCalcTxnHash  = 0x08
 
-	p1First = 0x00
-	p1More  = 0x80
+	p1Version    = 0x00
+	p1CacheStats = 0x01
+
+	p1Single   = 0x00
+	p1Range    = 0x01
+	p1NextKeys = 0x02
+
+	p1BatchFirst = 0x01
+	p1BatchMore  = 0x02
+	p1BatchSign  = 0x03
+	p1BatchNext  = 0x04
+
+	p1First  = 0x00
+	p1More   = 0x80
+	p1Next   = 0x01
+	p1Reuse  = 0x02
+	p1Abort  = 0x03
+	p1Export = 0x04
+	p1Import = 0x05
 
 	p2DisplayAddress = 0x00
 	p2DisplayPubkey  = 0x01
 	p2DisplayHash    = 0x00
 	p2SignHash       = 0x01
+	p2Multi          = 0x02
+	p2Summary        = 0x04
+	p2HashOnly       = 0x08
+	p2Resumable      = 0x10
+	p2Compressed     = 0x20
+	p2SigHeaders     = 0x40
+	p2Partial        = 0x80
 )
 
 func (n *Nano) GetVersion() (version string, err error) {
-	resp, err := n.Exchange(cmdGetVersion, 0, 0, nil)
+	resp, err := n.Exchange(cmdGetVersion, p1Version, 0, nil)
 	if err != nil {
 		return "", err
-	} else if len(resp) != 3 {
+	} else if len(resp) != 3 && len(resp) != 5 && len(resp) != 6 {
 		return "", errors.New("version has wrong length")
 	}
 	return fmt.Sprintf("v%d.%d.%d", resp[0], resp[1], resp[2]), nil
 }
 
+// KeyCacheStats returns the number of times the device has found a public
+// key in its cache, and the number of times it has had to derive one, since
+// the Sia app started.
+func (n *Nano) KeyCacheStats() (hits, misses uint32, err error) {
+	resp, err := n.Exchange(cmdGetVersion, p1CacheStats, 0, nil)
+	if err != nil {
+		return 0, 0, err
+	} else if len(resp) != 8 {
+		return 0, 0, errors.New("cache stats have wrong length")
+	}
+	return binary.BigEndian.Uint32(resp[0:]), binary.BigEndian.Uint32(resp[4:]), nil
+}
+
+// payloadSize returns the largest APDU payload that the device accepts.
+// Newer versions of the app report this in their getVersion response; older
+// versions only accept short APDUs.
+func (n *Nano) payloadSize() int {
+	if n.maxPayload == 0 {
+		n.maxPayload = 255
+		n.dictSlots = 8
+		resp, err := n.Exchange(cmdGetVersion, p1Version, 0, nil)
+		if err == nil && len(resp) >= 5 {
+			if size := int(binary.BigEndian.Uint16(resp[3:])); size > 255 {
+				n.maxPayload = size
+			}
+		}
+		if err == nil && len(resp) >= 6 {
+			n.dictSlots = int(resp[5])
+		}
+	}
+	return n.maxPayload
+}
+
+// compressionSlots returns the number of dictionary slots available to
+// compressed uploads. Apps that don't report it have 8.
+func (n *Nano) compressionSlots() int {
+	n.payloadSize()
+	return n.dictSlots
+}
+
 func (n *Nano) GetPublicKey(index uint32) (pubkey [32]byte, err error) {
 	encIndex := make([]byte, 4)
 	binary.LittleEndian.PutUint32(encIndex, index)
 
-	resp, err := n.Exchange(cmdGetPublicKey, 0, p2DisplayPubkey, encIndex)
+	resp, err := n.Exchange(cmdGetPublicKey, p1Single, p2DisplayPubkey, encIndex)
 	if err != nil {
 		return [32]byte{}, err
 	}
@@ -216,7 +316,7 @@ func (n *Nano) GetAddress(index uint32) (addr types.UnlockHash, err error) {
 	encIndex := make([]byte, 4)
 	binary.LittleEndian.PutUint32(encIndex, index)
 
-	resp, err := n.Exchange(cmdGetPublicKey, 0, p2DisplayAddress, encIndex)
+	resp, err := n.Exchange(cmdGetPublicKey, p1Single, p2DisplayAddress, encIndex)
 	if err != nil {
 		return types.UnlockHash{}, err
 	}
@@ -224,11 +324,61 @@ func (n *Nano) GetAddress(index uint32) (addr types.UnlockHash, err error) {
 	return
 }
 
+// MaxKeyRange is the largest number of keys that the device will derive for a
+// single GetKeyRange call.
+const MaxKeyRange = 1000
+
+// GetKeyRange returns the public keys with indices start through
+// start+count-1, along with their addresses if withAddrs is set. The user
+// approves the whole range at once. count may be at most MaxKeyRange.
+func (n *Nano) GetKeyRange(start, count uint32, withAddrs bool) (pubkeys [][32]byte, addrs []types.UnlockHash, err error) {
+	if count == 0 {
+		return nil, nil, errors.New("no keys requested")
+	} else if count > MaxKeyRange {
+		return nil, nil, fmt.Errorf("too many keys requested (%v); the device can derive at most %v at once", count, MaxKeyRange)
+	}
+	enc := make([]byte, 8)
+	binary.LittleEndian.PutUint32(enc[0:], start)
+	binary.LittleEndian.PutUint32(enc[4:], count)
+	p2, size := byte(p2DisplayPubkey), 32
+	if withAddrs {
+		p2, size = p2DisplayAddress, 64
+	}
+
+	// the device responds to the approval with an empty response, after
+	// which the keys are fetched with p1NextKeys
+	if _, err := n.Exchange(cmdGetPublicKey, p1Range, p2, enc); err != nil {
+		return nil, nil, err
+	}
+	for len(pubkeys) < int(count) {
+		resp, err := n.Exchange(cmdGetPublicKey, p1NextKeys, p2, nil)
+		if err != nil {
+			return nil, nil, err
+		} else if len(resp) == 0 || len(resp)%size != 0 {
+			return nil, nil, errors.New("keys have wrong length")
+		}
+		for ; len(resp) > 0; resp = resp[size:] {
+			var pk [32]byte
+			copy(pk[:], resp)
+			pubkeys = append(pubkeys, pk)
+			if withAddrs {
+				var addr types.UnlockHash
+				copy(addr[:], resp[32:])
+				addrs = append(addrs, addr)
+			}
+		}
+	}
+	if len(pubkeys) != int(count) {
+		return nil, nil, errors.New("received wrong number of keys")
+	}
+	return pubkeys, addrs, nil
+}
+
 func (n *Nano) SignHash(hash [32]byte, keyIndex uint32) (sig [64]byte, err error) {
 	encIndex := make([]byte, 4)
 	binary.LittleEndian.PutUint32(encIndex, keyIndex)
 
-	resp, err := n.Exchange(cmdSignHash, 0, 0, append(encIndex, hash[:]...))
+	resp, err := n.Exchange(cmdSignHash, p1Single, 0, append(encIndex, hash[:]...))
 	if err != nil {
 		return [64]byte{}, err
 	}
@@ -238,22 +388,327 @@ func (n *Nano) SignHash(hash [32]byte, keyIndex uint32) (sig [64]byte, err error
 	return
 }
 
+// MaxHashBatch is the largest number of hashes that the device will sign with
+// a single approval.
+const MaxHashBatch = 40
+
+// encodeHashBatch encodes each (key index, hash) pair as the device expects:
+// a 4-byte little-endian key index followed by the hash.
+func encodeHashBatch(hashes [][32]byte, keyIndices []uint32) []byte {
+	buf := make([]byte, 36*len(hashes))
+	for i := range hashes {
+		binary.LittleEndian.PutUint32(buf[36*i:], keyIndices[i])
+		copy(buf[36*i+4:], hashes[i][:])
+	}
+	return buf
+}
+
+// HashBatchDigest returns the digest that the device displays when asked to
+// sign a batch of hashes. The user should check that it matches before
+// approving the batch.
+func HashBatchDigest(hashes [][32]byte, keyIndices []uint32) [32]byte {
+	return crypto.HashBytes(encodeHashBatch(hashes, keyIndices))
+}
+
+// SignHashes signs each hash using the private key with the corresponding
+// index. The user approves the whole batch at once, after comparing its
+// HashBatchDigest. At most MaxHashBatch hashes may be signed per call.
+func (n *Nano) SignHashes(hashes [][32]byte, keyIndices []uint32) (sigs [][64]byte, err error) {
+	if len(hashes) != len(keyIndices) {
+		return nil, errors.New("must supply one key index per hash")
+	} else if len(hashes) == 0 || len(hashes) > MaxHashBatch {
+		return nil, fmt.Errorf("batch must contain between 1 and %v hashes", MaxHashBatch)
+	}
+
+	// send the pairs, as many per packet as fit
+	buf := encodeHashBatch(hashes, keyIndices)
+	perPacket := 36 * (n.payloadSize() / 36)
+	p1 := byte(p1BatchFirst)
+	for len(buf) > 0 {
+		m := perPacket
+		if m > len(buf) {
+			m = len(buf)
+		}
+		if _, err := n.Exchange(cmdSignHash, p1, 0, buf[:m]); err != nil {
+			return nil, err
+		}
+		buf = buf[m:]
+		p1 = p1BatchMore
+	}
+
+	resp, err := n.Exchange(cmdSignHash, p1BatchSign, 0, nil)
+	if err != nil {
+		return nil, err
+	}
+	// if the signatures don't fit in a single response, fetch the rest
+	for len(resp) < 64*len(hashes) {
+		more, err := n.Exchange(cmdSignHash, p1BatchNext, 0, nil)
+		if err != nil {
+			return nil, err
+		} else if len(more) == 0 {
+			return nil, errors.New("signatures have wrong length")
+		}
+		resp = append(resp, more...)
+	}
+	if len(resp) != 64*len(hashes) {
+		return nil, errors.New("signatures have wrong length")
+	}
+	sigs = make([][64]byte, len(hashes))
+	for i := range sigs {
+		copy(sigs[i][:], resp[64*i:])
+	}
+	return
+}
+
+// ReadHashBatch reads (hash, key index) pairs from r, one per line, each
+// written as a hex-encoded hash and a key index separated by whitespace.
+// Blank lines are ignored.
+func ReadHashBatch(r io.Reader) (hashes [][32]byte, keyIndices []uint32, err error) {
+	s := bufio.NewScanner(r)
+	for line := 1; s.Scan(); line++ {
+		fields := strings.Fields(s.Text())
+		if len(fields) == 0 {
+			continue
+		} else if len(fields) != 2 {
+			return nil, nil, fmt.Errorf("line %v: expected hash and key index", line)
+		}
+		hashBytes, err := hex.DecodeString(fields[0])
+		if err != nil {
+			return nil, nil, fmt.Errorf("line %v: %v", line, err)
+		} else if len(hashBytes) != 32 {
+			return nil, nil, fmt.Errorf("line %v: wrong hex hash length (%v, wanted 32)", line, len(hashBytes))
+		}
+		var hash [32]byte
+		copy(hash[:], hashBytes)
+		index, err := strconv.ParseUint(fields[1], 10, 32)
+		if err != nil {
+			return nil, nil, fmt.Errorf("line %v: %v", line, err)
+		}
+		hashes = append(hashes, hash)
+		keyIndices = append(keyIndices, uint32(index))
+	}
+	return hashes, keyIndices, s.Err()
+}
+
+// maxRetries is the number of times sendTxn will resend a packet before
+// giving up.
+const maxRetries = 3
+
+// sendTxn streams buf to the device as a calcTxnHash command, returning the
+// response to the final packet. The first hdrLen bytes of buf are the indices
+// that precede the transaction. Each packet is as large as the device allows.
+//
+// The transaction is sent in resumable mode, so each packet after the first
+// is prefixed with its offset in the transaction. If a packet is lost in
+// transit, it is resent, and if the device reports that it is missing data,
+// the upload resumes from wherever it left off. If a previous upload was
+// interrupted, it is aborted before starting this one.
+func (n *Nano) sendTxn(buf *bytes.Buffer, hdrLen int, p2 byte) (resp []byte, err error) {
+	if n.HashOnly && p2&p2SignHash == 0 {
+		p2 |= p2HashOnly
+	} else if n.Summary {
+		p2 |= p2Summary
+	}
+	p2 |= p2Resumable
+	payloadSize := n.payloadSize()
+
+	data := buf.Bytes()
+	if n.Compress {
+		p2 |= p2Compressed
+		data = append(data[:hdrLen:hdrLen], compressTxn(data[hdrLen:], n.compressionSlots())...)
+	}
+	first := data
+	if len(first) > payloadSize {
+		first = first[:payloadSize]
+	}
+	resp, err = n.Exchange(cmdCalcTxnHash, p1First, p2, first)
+	if err == ErrCode(codeImproperInit) {
+		if _, err = n.Exchange(cmdCalcTxnHash, p1Abort, 0, nil); err != nil {
+			return nil, err
+		}
+		resp, err = n.Exchange(cmdCalcTxnHash, p1First, p2, first)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	txn := data[hdrLen:]
+	off := len(first) - hdrLen
+	if off == len(txn) {
+		return resp, nil
+	}
+	return n.sendTxnFrom(txn, off, p2)
+}
+
+// sendTxnFrom sends the remainder of a resumable transaction upload, starting
+// at offset off.
+func (n *Nano) sendTxnFrom(txn []byte, off int, p2 byte) (resp []byte, err error) {
+	payloadSize := n.payloadSize()
+	for retries := 0; off < len(txn); {
+		chunk := txn[off:]
+		if len(chunk) > payloadSize-4 {
+			chunk = chunk[:payloadSize-4]
+		}
+		pkt := make([]byte, 4+len(chunk))
+		binary.LittleEndian.PutUint32(pkt, uint32(off))
+		copy(pkt[4:], chunk)
+		resp, err = n.Exchange(cmdCalcTxnHash, p1More, p2, pkt)
+		_, isCode := err.(ErrCode)
+		if err == ErrCode(codeBadOffset) && len(resp) == 4 && retries < maxRetries {
+			// a packet was dropped; resume from where the device left off
+			off = int(binary.LittleEndian.Uint32(resp))
+			retries++
+			continue
+		} else if err != nil && !isCode && err != errUserRejected && err != errInvalidParam && retries < maxRetries {
+			// the packet (or its response) was lost in transit; send it
+			// again
+			retries++
+			continue
+		} else if err != nil {
+			n.Exchange(cmdCalcTxnHash, p1Abort, 0, nil) // best effort
+			return nil, err
+		}
+		off += len(chunk)
+		retries = 0
+	}
+	return resp, nil
+}
+
+// compressTxn compresses an encoded transaction for a P2_COMPRESSED upload
+// (see expand.c in the Nano app). Runs of zeros are elided, and any 32-byte
+// value (e.g. a public key), or 24-byte specifier and length, that occurs
+// more than once is stored in the device's dictionary, which has dictSlots
+// slots, the first time it is seen, and referenced thereafter.
+func compressTxn(data []byte, dictSlots int) []byte {
+	widths := []int{32, 24}
+	isZero := func(b []byte) bool { return bytes.Count(b, []byte{0}) == len(b) }
+	counts := make(map[string]int)
+	for _, w := range widths {
+		for i := 0; i+w <= len(data); i++ {
+			counts[string(data[i:i+w])]++
+		}
+	}
+
+	var out, lit []byte
+	flush := func() {
+		for len(lit) > 0 {
+			n := len(lit)
+			if n > 128 {
+				n = 128
+			}
+			out = append(out, byte(n-1))
+			out = append(out, lit[:n]...)
+			lit = lit[n:]
+		}
+	}
+	dict := make([]string, dictSlots)
+	var nextSlot int
+outer:
+	for i := 0; i < len(data); {
+		// Short runs of zeros are cheaper as part of a literal.
+		z := 0
+		for i+z < len(data) && data[i+z] == 0 && z < 64 {
+			z++
+		}
+		if z >= 3 {
+			flush()
+			out = append(out, 0x80+byte(z-1))
+			i += z
+			continue
+		}
+		for _, w := range widths {
+			if i+w > len(data) || counts[string(data[i:i+w])] < 2 || isZero(data[i:i+w]) {
+				continue
+			}
+			v := string(data[i : i+w])
+			flush()
+			for slot := range dict {
+				if dict[slot] == v {
+					out = append(out, 0xE0+byte(slot))
+					i += w
+					continue outer
+				}
+			}
+			out = append(out, 0xC0+byte(w-1))
+			out = append(out, v...)
+			dict[nextSlot] = v
+			nextSlot = (nextSlot + 1) % dictSlots
+			i += w
+			continue outer
+		}
+		lit = append(lit, data[i])
+		i++
+	}
+	flush()
+	return out
+}
+
+// SaveTxnState returns a continuation token holding the progress of the
+// transaction currently being sent to the device. The token is encrypted and
+// authenticated by the device, and remains valid until the Sia app exits. It
+// can only be saved between packets, once the user has reviewed every output
+// received so far.
+func (n *Nano) SaveTxnState() (token []byte, err error) {
+	for {
+		off := make([]byte, 2)
+		binary.LittleEndian.PutUint16(off, uint16(len(token)))
+		part, err := n.Exchange(cmdCalcTxnHash, p1Export, 0, off)
+		if err != nil {
+			return nil, err
+		} else if len(part) == 0 {
+			return token, nil
+		}
+		token = append(token, part...)
+	}
+}
+
+// ResumeTxn restores the progress saved in token, and sends the rest of txn,
+// which must be the transaction (and sigIndices the signatures) that was
+// being sent when the token was saved. It returns the device's final
+// response: the hash(es) or signature(s) that CalcTxnHash(es) or SignTxn(s)
+// would have returned.
+func (n *Nano) ResumeTxn(token []byte, txn types.Transaction, sigIndices []uint16) (resp []byte, err error) {
+	partSize := n.payloadSize() - 2
+	for off := 0; off < len(token); off += partSize {
+		part := token[off:]
+		if len(part) > partSize {
+			part = part[:partSize]
+		}
+		pkt := make([]byte, 2+len(part))
+		binary.LittleEndian.PutUint16(pkt, uint16(off))
+		copy(pkt[2:], part)
+		if resp, err = n.Exchange(cmdCalcTxnHash, p1Import, 0, pkt); err != nil {
+			return nil, err
+		}
+	}
+	if len(resp) != 4 {
+		return nil, errors.New("offset has wrong length")
+	}
+	buf := new(bytes.Buffer)
+	p2, err := marshalTxn(buf, txn, sigIndices, n.OmitSigs)
+	if err != nil {
+		return nil, err
+	}
+	data := buf.Bytes()
+	p2 |= p2Resumable
+	if n.Compress {
+		data, p2 = compressTxn(data, n.compressionSlots()), p2|p2Compressed
+	}
+	return n.sendTxnFrom(data, int(binary.LittleEndian.Uint32(resp)), p2)
+}
+
 func (n *Nano) CalcTxnHash(txn types.Transaction, sigIndex uint16) (hash [32]byte, err error) {
 	buf := new(bytes.Buffer)
 	binary.Write(buf, binary.LittleEndian, uint32(0)) // keyIndex
 	binary.Write(buf, binary.LittleEndian, sigIndex)
-	txn.MarshalSia(buf)
+	p2, err := marshalTxn(buf, txn, []uint16{sigIndex}, n.OmitSigs)
+	if err != nil {
+		return [32]byte{}, err
+	}
 
-	var resp []byte
-	for buf.Len() > 0 {
-		var p1 byte = p1More
-		if resp == nil {
-			p1 = p1First
-		}
-		resp, err = n.Exchange(cmdCalcTxnHash, p1, p2DisplayHash, buf.Next(255))
-		if err != nil {
-			return [32]byte{}, err
-		}
+	resp, err := n.sendTxn(buf, 6, p2DisplayHash|p2)
+	if err != nil {
+		return [32]byte{}, err
 	}
 	if copy(hash[:], resp) != len(hash) {
 		return [32]byte{}, errors.New("hash has wrong length")
@@ -265,18 +720,238 @@ func (n *Nano) SignTxn(txn types.Transaction, sigIndex uint16, keyIndex uint32)
 	buf := new(bytes.Buffer)
 	binary.Write(buf, binary.LittleEndian, keyIndex)
 	binary.Write(buf, binary.LittleEndian, sigIndex)
+	p2, err := marshalTxn(buf, txn, []uint16{sigIndex}, n.OmitSigs)
+	if err != nil {
+		return [64]byte{}, err
+	}
+
+	resp, err := n.sendTxn(buf, 6, p2SignHash|p2)
+	if err != nil {
+		return [64]byte{}, err
+	}
+	if copy(sig[:], resp) != len(sig) {
+		return [64]byte{}, errors.New("signature has wrong length")
+	}
+	return
+}
+
+// marshalTxn encodes txn for a calcTxnHash command, returning the P2 flag
+// that describes the encoding, if any. If the (single) requested signature
+// does not cover the whole transaction, only the elements it covers are
+// encoded, for P2_PARTIAL. Otherwise, if omitSigs is set, the
+// TransactionSignatures are abridged for P2_SIG_HEADERS: their count is
+// followed only by the header (ParentID, PublicKeyIndex, and Timelock) of
+// each signature in sigIndices.
+func marshalTxn(buf *bytes.Buffer, txn types.Transaction, sigIndices []uint16, omitSigs bool) (byte, error) {
+	sigs := txn.TransactionSignatures
+	for _, i := range sigIndices {
+		if int(i) >= len(sigs) {
+			return 0, errors.New("sig index out of range")
+		}
+		if !sigs[i].CoveredFields.WholeTransaction {
+			if len(sigIndices) > 1 {
+				return 0, errors.New("partial signatures must be calculated one at a time")
+			}
+			ct, err := coveredTxn(txn, sigs[i].CoveredFields)
+			if err != nil {
+				return 0, err
+			}
+			ct.MarshalSia(buf)
+			return p2Partial, nil
+		}
+	}
+	if !omitSigs {
+		txn.MarshalSia(buf)
+		return 0, nil
+	}
+	txn.TransactionSignatures = nil
 	txn.MarshalSia(buf)
+	buf.Truncate(buf.Len() - 8) // length prefix of the empty TransactionSignatures
+	binary.Write(buf, binary.LittleEndian, uint64(len(sigs)))
+	for _, i := range sigIndices {
+		buf.Write(sigs[i].ParentID[:])
+		binary.Write(buf, binary.LittleEndian, sigs[i].PublicKeyIndex)
+		binary.Write(buf, binary.LittleEndian, uint64(sigs[i].Timelock))
+	}
+	return p2SigHeaders, nil
+}
 
-	var resp []byte
-	for buf.Len() > 0 {
-		var p1 byte = p1More
-		if resp == nil {
-			p1 = p1First
+// coveredTxn returns a transaction made up of just the elements of txn that
+// are covered by cf, in the order they are listed. Its encoding is what the
+// device expects with P2_PARTIAL.
+func coveredTxn(txn types.Transaction, cf types.CoveredFields) (ct types.Transaction, err error) {
+	inRange := func(indices []uint64, n int) bool {
+		for _, i := range indices {
+			if i >= uint64(n) {
+				return false
+			}
+		}
+		return true
+	}
+	if !inRange(cf.SiacoinInputs, len(txn.SiacoinInputs)) ||
+		!inRange(cf.SiacoinOutputs, len(txn.SiacoinOutputs)) ||
+		!inRange(cf.FileContracts, len(txn.FileContracts)) ||
+		!inRange(cf.FileContractRevisions, len(txn.FileContractRevisions)) ||
+		!inRange(cf.StorageProofs, len(txn.StorageProofs)) ||
+		!inRange(cf.SiafundInputs, len(txn.SiafundInputs)) ||
+		!inRange(cf.SiafundOutputs, len(txn.SiafundOutputs)) ||
+		!inRange(cf.MinerFees, len(txn.MinerFees)) ||
+		!inRange(cf.ArbitraryData, len(txn.ArbitraryData)) ||
+		!inRange(cf.TransactionSignatures, len(txn.TransactionSignatures)) {
+		return types.Transaction{}, errors.New("covered field index out of range")
+	}
+	for _, i := range cf.SiacoinInputs {
+		ct.SiacoinInputs = append(ct.SiacoinInputs, txn.SiacoinInputs[i])
+	}
+	for _, i := range cf.SiacoinOutputs {
+		ct.SiacoinOutputs = append(ct.SiacoinOutputs, txn.SiacoinOutputs[i])
+	}
+	for _, i := range cf.FileContracts {
+		ct.FileContracts = append(ct.FileContracts, txn.FileContracts[i])
+	}
+	for _, i := range cf.FileContractRevisions {
+		ct.FileContractRevisions = append(ct.FileContractRevisions, txn.FileContractRevisions[i])
+	}
+	for _, i := range cf.StorageProofs {
+		ct.StorageProofs = append(ct.StorageProofs, txn.StorageProofs[i])
+	}
+	for _, i := range cf.SiafundInputs {
+		ct.SiafundInputs = append(ct.SiafundInputs, txn.SiafundInputs[i])
+	}
+	for _, i := range cf.SiafundOutputs {
+		ct.SiafundOutputs = append(ct.SiafundOutputs, txn.SiafundOutputs[i])
+	}
+	for _, i := range cf.MinerFees {
+		ct.MinerFees = append(ct.MinerFees, txn.MinerFees[i])
+	}
+	for _, i := range cf.ArbitraryData {
+		ct.ArbitraryData = append(ct.ArbitraryData, txn.ArbitraryData[i])
+	}
+	for _, i := range cf.TransactionSignatures {
+		ct.TransactionSignatures = append(ct.TransactionSignatures, txn.TransactionSignatures[i])
+	}
+	return ct, nil
+}
+
+// MaxTxnSigs is the largest number of SigHashes that the device will compute
+// for a single P2_MULTI transaction.
+const MaxTxnSigs = 8
+
+// encodeMultiTxn encodes the first packet header for a P2_MULTI calcTxnHash
+// command, followed by the transaction. sigIndices must be in ascending order.
+func encodeMultiTxn(txn types.Transaction, sigIndices []uint16, keyIndices []uint32, omitSigs bool) (*bytes.Buffer, byte, error) {
+	if len(sigIndices) == 0 {
+		return nil, 0, errors.New("no signatures requested")
+	} else if len(sigIndices) > MaxTxnSigs {
+		return nil, 0, fmt.Errorf("too many signatures requested (%v); the device can compute at most %v per transaction", len(sigIndices), MaxTxnSigs)
+	}
+	buf := new(bytes.Buffer)
+	buf.WriteByte(byte(len(sigIndices)))
+	for i, sigIndex := range sigIndices {
+		if i > 0 && sigIndex <= sigIndices[i-1] {
+			return nil, 0, errors.New("sig indices must be in ascending order")
 		}
-		resp, err = n.Exchange(cmdCalcTxnHash, p1, p2SignHash, buf.Next(255))
+		var keyIndex uint32
+		if keyIndices != nil {
+			keyIndex = keyIndices[i]
+		}
+		binary.Write(buf, binary.LittleEndian, keyIndex)
+		binary.Write(buf, binary.LittleEndian, sigIndex)
+	}
+	p2, err := marshalTxn(buf, txn, sigIndices, omitSigs)
+	if err != nil {
+		return nil, 0, err
+	} else if p2 == p2Partial {
+		return nil, 0, errors.New("partial signatures must be calculated one at a time")
+	}
+	return buf, p2, nil
+}
+
+// CalcTxnHashes calculates the SigHash of each of the specified signatures in
+// a single pass over the transaction.
+func (n *Nano) CalcTxnHashes(txn types.Transaction, sigIndices []uint16) (hashes [][32]byte, err error) {
+	buf, p2, err := encodeMultiTxn(txn, sigIndices, nil, n.OmitSigs)
+	if err != nil {
+		return nil, err
+	}
+	resp, err := n.sendTxn(buf, 1+6*len(sigIndices), p2DisplayHash|p2Multi|p2)
+	if err != nil {
+		return nil, err
+	} else if len(resp) != 32*len(sigIndices) {
+		return nil, errors.New("hashes have wrong length")
+	}
+	hashes = make([][32]byte, len(sigIndices))
+	for i := range hashes {
+		copy(hashes[i][:], resp[32*i:])
+	}
+	return
+}
+
+// SignTxns calculates and signs the SigHash of each of the specified
+// signatures in a single pass over the transaction, using the corresponding
+// key index for each. The user approves all of the signatures at once.
+func (n *Nano) SignTxns(txn types.Transaction, sigIndices []uint16, keyIndices []uint32) (sigs [][64]byte, err error) {
+	if len(keyIndices) != len(sigIndices) {
+		return nil, errors.New("must supply one key index per sig index")
+	}
+	buf, p2, err := encodeMultiTxn(txn, sigIndices, keyIndices, n.OmitSigs)
+	if err != nil {
+		return nil, err
+	}
+	resp, err := n.sendTxn(buf, 1+6*len(sigIndices), p2SignHash|p2Multi|p2)
+	if err != nil {
+		return nil, err
+	}
+	// if the signatures don't fit in a single response, fetch the rest
+	for len(resp) < 64*len(sigIndices) {
+		more, err := n.Exchange(cmdCalcTxnHash, p1Next, p2SignHash|p2Multi, nil)
 		if err != nil {
-			return [64]byte{}, err
+			return nil, err
+		} else if len(more) == 0 {
+			return nil, errors.New("signatures have wrong length")
 		}
+		resp = append(resp, more...)
+	}
+	if len(resp) != 64*len(sigIndices) {
+		return nil, errors.New("signatures have wrong length")
+	}
+	sigs = make([][64]byte, len(sigIndices))
+	for i := range sigs {
+		copy(sigs[i][:], resp[64*i:])
+	}
+	return
+}
+
+// CalcLastTxnHash calculates the SigHash of another signature of the
+// transaction most recently passed to CalcTxnHash(es) or SignTxn(s), without
+// sending the transaction again. The device can do this for any of the
+// signatures originally requested, and for as many of the first others as
+// fit in its table of 8.
+func (n *Nano) CalcLastTxnHash(sigIndex uint16) (hash [32]byte, err error) {
+	buf := make([]byte, 6)
+	binary.LittleEndian.PutUint16(buf[4:], sigIndex)
+	resp, err := n.Exchange(cmdCalcTxnHash, p1Reuse, p2DisplayHash, buf)
+	if err != nil {
+		return [32]byte{}, err
+	}
+	if copy(hash[:], resp) != len(hash) {
+		return [32]byte{}, errors.New("hash has wrong length")
+	}
+	return
+}
+
+// SignLastTxn signs the SigHash of another signature of the transaction most
+// recently passed to SignTxn(s), without sending the transaction again. The
+// user must have approved signing that transaction, and keyIndex must be one
+// of the keys they approved. sigIndex is subject to the same limits as in
+// CalcLastTxnHash.
+func (n *Nano) SignLastTxn(sigIndex uint16, keyIndex uint32) (sig [64]byte, err error) {
+	buf := make([]byte, 6)
+	binary.LittleEndian.PutUint32(buf[:4], keyIndex)
+	binary.LittleEndian.PutUint16(buf[4:], sigIndex)
+	resp, err := n.Exchange(cmdCalcTxnHash, p1Reuse, p2SignHash, buf)
+	if err != nil {
+		return [64]byte{}, err
 	}
 	if copy(sig[:], resp) != len(sig) {
 		return [64]byte{}, errors.New("signature has wrong length")
@@ -323,6 +998,29 @@ func OpenNano() (*Nano, error) {
 	}, nil
 }
 
+// parseIndices parses a comma-separated list of indices.
+func parseIndices(s string) []uint32 {
+	var indices []uint32
+	for _, f := range strings.Split(s, ",") {
+		indices = append(indices, parseIndex(f))
+	}
+	return indices
+}
+
+// parseRange parses either a single index or an inclusive range of them,
+// e.g. "0-99", returning the first index and the number of indices.
+func parseRange(s string) (start, count uint32) {
+	i := strings.IndexByte(s, '-')
+	if i < 0 {
+		return parseIndex(s), 1
+	}
+	start, end := parseIndex(s[:i]), parseIndex(s[i+1:])
+	if end < start || end-start == math.MaxUint32 {
+		log.Fatalln("Invalid index range:", s)
+	}
+	return start, end - start + 1
+}
+
 func parseIndex(s string) uint32 {
 	index, err := strconv.ParseUint(s, 10, 32)
 	if err != nil {
@@ -355,18 +1053,29 @@ the Sia Ledger Nano S app (if available).
 	sialedger addr [key index]
 
 Generates an address using the public key with the specified index.
+
+To generate many addresses with a single approval, supply an inclusive range
+of indices, e.g. "0-99".
 `
 	pubkeyUsage = `Usage:
 	sialedger pubkey [key index]
 
 Generates the public key with the specified index.
+
+To generate many public keys with a single approval, supply an inclusive
+range of indices, e.g. "0-99".
 `
 	hashUsage = `Usage:
 	sialedger hash [hex-encoded hash] [key index]
+	sialedger hash [file]
 
 Signs a 256-bit hash using the private key with the specified index. The hash
 must be hex-encoded.
 
+Given a file instead, signs each of the hashes it lists, one hash and key index
+per line, with a single approval per batch of 40. Before approving, check that
+the digest shown on the device matches the one printed here.
+
 Only sign hashes you trust. In practice, it is very difficult
 to calculate a hash in a trusted manner.
 `
@@ -374,10 +1083,19 @@ to calculate a hash in a trusted manner.
 	sialedger txn [flags] [txn.json] [sig index] [key index]
 
 Calculates and signs the hash of a transaction using the private key with the
-specified key index. The CoveredFields of the specified TransactionSignature
-must set WholeTransaction = true.
+specified key index. If the CoveredFields of the specified
+TransactionSignature do not set WholeTransaction = true, only the covered
+elements are sent to the device (and reviewed), and only one signature may be
+specified.
+
+To compute multiple signatures in a single pass, supply comma-separated lists
+of sig indices (in ascending order) and key indices, e.g. "0,2,5" "3,1,4".
 `
-	txnHashUsage = `calculate the transaction hash, but do not sign it`
+	txnHashUsage     = `calculate the transaction hash, but do not sign it`
+	txnSummaryUsage  = `review the total of each kind of output, rather than each output`
+	txnNoReviewUsage = `with -sighash, skip reviewing the transaction on the device`
+	txnCompressUsage = `compress the transaction before sending it`
+	txnOmitSigsUsage = `send only the headers of the specified signatures`
 )
 
 func main() {
@@ -392,6 +1110,10 @@ func main() {
 	hashCmd := flagg.New("hash", hashUsage)
 	txnCmd := flagg.New("txn", txnUsage)
 	txnHash := txnCmd.Bool("sighash", false, txnHashUsage)
+	txnSummary := txnCmd.Bool("summary", false, txnSummaryUsage)
+	txnNoReview := txnCmd.Bool("noreview", false, txnNoReviewUsage)
+	txnCompress := txnCmd.Bool("compress", false, txnCompressUsage)
+	txnOmitSigs := txnCmd.Bool("omitsigs", false, txnOmitSigsUsage)
 
 	cmd := flagg.Parse(flagg.Tree{
 		Cmd: rootCmd,
@@ -433,12 +1155,27 @@ func main() {
 
 		fmt.Printf("%s v0.1.0\n", os.Args[0])
 		fmt.Println("Nano app version:", appVersion)
+		if nano != nil {
+			if hits, misses, err := nano.KeyCacheStats(); err == nil {
+				fmt.Printf("Key cache: %v hits, %v misses\n", hits, misses)
+			}
+		}
 
 	case addrCmd:
 		if len(args) != 1 {
 			addrCmd.Usage()
 			return
 		}
+		if start, count := parseRange(args[0]); count > 1 {
+			_, addrs, err := nano.GetKeyRange(start, count, true)
+			if err != nil {
+				log.Fatalln("Couldn't get addresses:", err)
+			}
+			for _, addr := range addrs {
+				fmt.Println(addr)
+			}
+			return
+		}
 		addr, err := nano.GetAddress(parseIndex(args[0]))
 		if err != nil {
 			log.Fatalln("Couldn't get address:", err)
@@ -450,6 +1187,17 @@ func main() {
 			pubkeyCmd.Usage()
 			return
 		}
+		if start, count := parseRange(args[0]); count > 1 {
+			pubkeys, _, err := nano.GetKeyRange(start, count, false)
+			if err != nil {
+				log.Fatalln("Couldn't get public keys:", err)
+			}
+			for _, pubkey := range pubkeys {
+				pk := types.Ed25519PublicKey(pubkey)
+				fmt.Println(pk.String())
+			}
+			return
+		}
 		pubkey, err := nano.GetPublicKey(parseIndex(args[0]))
 		if err != nil {
 			log.Fatalln("Couldn't get public key:", err)
@@ -458,6 +1206,36 @@ func main() {
 		fmt.Println(pk.String())
 
 	case hashCmd:
+		if len(args) == 1 {
+			f, err := os.Open(args[0])
+			if err != nil {
+				log.Fatalln("Couldn't open hash file:", err)
+			}
+			hashes, keyIndices, err := ReadHashBatch(f)
+			f.Close()
+			if err != nil {
+				log.Fatalln("Couldn't read hashes:", err)
+			} else if len(hashes) == 0 {
+				log.Fatalln("No hashes to sign")
+			}
+			for len(hashes) > 0 {
+				m := MaxHashBatch
+				if m > len(hashes) {
+					m = len(hashes)
+				}
+				digest := HashBatchDigest(hashes[:m], keyIndices[:m])
+				fmt.Fprintf(os.Stderr, "Please verify that the device displays %v hashes with digest:\n%x\n", m, digest)
+				sigs, err := nano.SignHashes(hashes[:m], keyIndices[:m])
+				if err != nil {
+					log.Fatalln("Couldn't get signatures:", err)
+				}
+				for _, sig := range sigs {
+					fmt.Println(base64.StdEncoding.EncodeToString(sig[:]))
+				}
+				hashes, keyIndices = hashes[m:], keyIndices[m:]
+			}
+			return
+		}
 		if len(args) != 2 {
 			hashCmd.Usage()
 			return
@@ -490,16 +1268,39 @@ func main() {
 		if err := json.Unmarshal(txnBytes, &txn); err != nil {
 			log.Fatalln("Couldn't decode transaction:", err)
 		}
-		sigIndex := uint16(parseIndex(args[1]))
+		nano.Summary = *txnSummary
+		nano.HashOnly = *txnNoReview
+		nano.Compress = *txnCompress
+		nano.OmitSigs = *txnOmitSigs
+		var sigIndices []uint16
+		for _, i := range parseIndices(args[1]) {
+			sigIndices = append(sigIndices, uint16(i))
+		}
 
-		if *txnHash {
-			sighash, err := nano.CalcTxnHash(txn, sigIndex)
+		if *txnHash && len(sigIndices) > 1 {
+			sighashes, err := nano.CalcTxnHashes(txn, sigIndices)
+			if err != nil {
+				log.Fatalln("Couldn't get hashes:", err)
+			}
+			for _, sighash := range sighashes {
+				fmt.Println(hex.EncodeToString(sighash[:]))
+			}
+		} else if *txnHash {
+			sighash, err := nano.CalcTxnHash(txn, sigIndices[0])
 			if err != nil {
 				log.Fatalln("Couldn't get hash:", err)
 			}
 			fmt.Println(hex.EncodeToString(sighash[:]))
+		} else if len(sigIndices) > 1 {
+			sigs, err := nano.SignTxns(txn, sigIndices, parseIndices(args[2]))
+			if err != nil {
+				log.Fatalln("Couldn't get signatures:", err)
+			}
+			for _, sig := range sigs {
+				fmt.Println(base64.StdEncoding.EncodeToString(sig[:]))
+			}
 		} else {
-			sig, err := nano.SignTxn(txn, sigIndex, parseIndex(args[2]))
+			sig, err := nano.SignTxn(txn, sigIndices[0], parseIndex(args[2]))
 			if err != nil {
 				log.Fatalln("Couldn't get signature:", err)
 			}
@@ -6,8 +6,10 @@
 // the command on their computer by requesting the hash of a specific
 // transaction. A flag in the request controls whether the resulting hash
 // should be signed. The command handler then begins reading transaction data
-// from the computer, in packets of up to 255 bytes at a time. The handler
-// buffers this data until a full "element" in parsed. Depending on the type
+// from the computer, in packets of up to 255 bytes at a time (or more, if the
+// computer uses extended-length APDUs; see getVersion.c). The handler
+// parses each packet in place, buffering only the tail of any "element" that
+// spans two packets. Depending on the type
 // of the element, it may then be displayed to the user for comparison. Once
 // all elements have been received and parsed, the final screen differs
 // depending on whether a signature was requested. If so, the user is prompted
@@ -21,6 +23,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <os_io_seproxyhal.h>
 #include <ux.h>
@@ -31,14 +34,16 @@
 static calcTxnHashContext_t *ctx = &global.calcTxnHashContext;
 
 static unsigned int ui_calcTxnHash_elem_button(void);
+static unsigned int ui_calcTxnHash_summary_button(void);
+static unsigned int ui_calcTxnHash_compare_button(void);
 static unsigned int io_seproxyhal_touch_txn_hash_ok(void);
 
 UX_STEP_CB(
 	ux_compare_hash_flow_1_step,
 	bnnn_paging,
-	ui_idle(),
+	ui_calcTxnHash_compare_button(),
 	{
-		"Compare Hash:",
+		global.calcTxnHashContext.labelStr,
 		global.calcTxnHashContext.fullStr
 	}
 );
@@ -50,9 +55,9 @@ UX_DEF(
 
 UX_STEP_NOCB(
 	ux_sign_txn_flow_1_step,
-	nn,
+	bnnn_paging,
 	{
-		"Sign this txn",
+		global.calcTxnHashContext.labelStr,
 		global.calcTxnHashContext.fullStr
 	}
 );
@@ -99,46 +104,286 @@ UX_DEF(
 	&ux_show_txn_elem_1_step
 );
 
+UX_STEP_CB(
+	ux_txn_summary_1_step,
+	bnnn_paging,
+	ui_calcTxnHash_summary_button(),
+	{
+		global.calcTxnHashContext.labelStr,
+		global.calcTxnHashContext.fullStr
+	}
+);
+
+UX_DEF(
+	ux_txn_summary_flow,
+	&ux_txn_summary_1_step
+);
+
+// sendSigs signs as many of the remaining SigHashes as will fit in a single
+// response APDU, and sends them to the computer. If any SigHashes remain, the
+// computer can request them with P1_NEXT. If a SigHash is unavailable, the
+// approval is revoked and SW_IMPROPER_INIT is sent instead; the caller
+// returns to the main menu.
+static void sendSigs(void) {
+	uint16_t tx = 0;
+	while (ctx->sigPart < ctx->txn.numSigs && tx + 64 + 2 <= sizeof(G_io_apdu_buffer)) {
+		uint8_t hash[32];
+		if (!txn_sighash(&ctx->txn, ctx->txn.sigIndices[ctx->sigPart], hash)) {
+			ctx->approved = false;
+			ctx->reviewed = false;
+			clearSigningKey();
+			io_exchange_with_code(SW_IMPROPER_INIT, 0);
+			return;
+		}
+		deriveAndSign(G_io_apdu_buffer + tx, ctx->keyIndices[ctx->sigPart], hash);
+		tx += 64;
+		ctx->sigPart++;
+	}
+	if (ctx->sigPart == ctx->txn.numSigs) {
+		ctx->approved = false;
+		clearSigningKey();
+	}
+	io_exchange_with_code(SW_OK, tx);
+}
+
 static unsigned int io_seproxyhal_touch_txn_hash_ok(void) {
-	deriveAndSign(G_io_apdu_buffer, ctx->keyIndex, ctx->txn.sigHash);
-	io_exchange_with_code(SW_OK, 64);
+	// If the computer has started sending another transaction since this
+	// screen was displayed, the approval would apply to a transaction the
+	// user never reviewed. (P1_FIRST dismisses this screen, but be sure.)
+	if (ctx->initialized || ctx->importing) {
+		ui_idle();
+		return 0;
+	}
+	ctx->approved = true;
+	ctx->reviewed = true;
+	ctx->sigPart = 0;
+	sendSigs();
 	ui_idle();
+	return 0;
+}
+
+// fmtSignPrompt prepares the approval screen, listing the key that will be
+// used for each signature. The user is warned if the signature only covers
+// part of the transaction.
+static void fmtSignPrompt(calcTxnHashContext_t *ctx) {
+	if (ctx->txn.mode == TXN_MODE_PARTIAL) {
+		memmove(ctx->labelStr, "Sign part of txn", 17);
+	} else {
+		memmove(ctx->labelStr, "Sign this txn", 14);
+	}
+	uint8_t *p = ctx->fullStr;
+	memmove(p, "with key", 8);
+	p += 8;
+	if (ctx->txn.numSigs > 1) {
+		*p++ = 's';
+	}
+	for (int i = 0; i < ctx->txn.numSigs; i++) {
+		memmove(p, (i == 0) ? " #" : ", #", (i == 0) ? 2 : 3);
+		p += (i == 0) ? 2 : 3;
+		p += bin2dec(p, ctx->keyIndices[i]);
+	}
+	memmove(p, "?", 2);
+}
+
+// fmtSigHash prepares the comparison screen for the SigHash at
+// ctx->sigPart. If more than one SigHash was requested, the label includes
+// the signature index. It returns false if the SigHash is unavailable.
+static bool fmtSigHash(calcTxnHashContext_t *ctx) {
+	if (ctx->txn.mode == TXN_MODE_PARTIAL) {
+		memmove(ctx->labelStr, "Compare Partial Hash:", 22);
+	} else if (ctx->txn.numSigs == 1) {
+		memmove(ctx->labelStr, "Compare Hash:", 14);
+	} else {
+		memmove(ctx->labelStr, "Compare Hash #", 14);
+		memmove(ctx->labelStr+14+bin2dec(ctx->labelStr+14, ctx->txn.sigIndices[ctx->sigPart]), ":", 2);
+	}
+	uint8_t hash[32];
+	if (!txn_sighash(&ctx->txn, ctx->txn.sigIndices[ctx->sigPart], hash)) {
+		return false;
+	}
+	bin2hex(ctx->fullStr, hash, 32);
+	return true;
+}
+
+// sendHashes sends all of the requested SigHashes to the computer, or
+// SW_IMPROPER_INIT if any of them is unavailable. It returns false in the
+// latter case.
+static bool sendHashes(void) {
+	for (int i = 0; i < ctx->txn.numSigs; i++) {
+		if (!txn_sighash(&ctx->txn, ctx->txn.sigIndices[i], G_io_apdu_buffer + 32*i)) {
+			io_exchange_with_code(SW_IMPROPER_INIT, 0);
+			return false;
+		}
+	}
+	io_exchange_with_code(SW_OK, 32*ctx->txn.numSigs);
+	return true;
+}
+
+static unsigned int ui_calcTxnHash_compare_button(void) {
+	// The computer may have started sending another transaction while this
+	// screen was displayed (e.g. with P2_HASH_ONLY), in which case the
+	// remaining SigHashes are no longer available.
+	if (ctx->initialized || ctx->importing) {
+		ui_idle();
+		return 0;
+	}
+	// If multiple SigHashes were requested, step through them one at a time
+	// before returning to the main menu.
+	ctx->sigPart++;
+	if (ctx->sigPart < ctx->txn.numSigs && fmtSigHash(ctx)) {
+		ux_flow_init(0, ux_compare_hash_flow, NULL);
+	} else {
+		ui_idle();
+	}
+	return 0;
+}
+
+// fmtSummary prepares the summary screen at ctx->elemPart, showing the total
+// of each kind of output.
+static void fmtSummary(calcTxnHashContext_t *ctx) {
+	txn_state_t *txn = &ctx->txn;
+	switch (ctx->elemPart) {
+	case 0:
+		memmove(ctx->labelStr, "Total SC Output", 16);
+		formatSC(ctx->fullStr, cur_fmt(ctx->fullStr, &txn->scTotal));
+		break;
+	case 1:
+		memmove(ctx->labelStr, "Total SF Output", 16);
+		memmove(ctx->fullStr+cur_fmt(ctx->fullStr, &txn->sfTotal), " SF", 4);
+		break;
+	case 2:
+		memmove(ctx->labelStr, "Total Miner Fees", 17);
+		formatSC(ctx->fullStr, cur_fmt(ctx->fullStr, &txn->feeTotal));
+		break;
+	}
+}
+
+// showFinal displays the final screen: the approval screen if we're signing,
+// or the comparison screen for the first SigHash otherwise.
+static void showFinal(void) {
+	if (ctx->sign) {
+		fmtSignPrompt(ctx);
+		ux_flow_init(0, ux_sign_txn_flow, NULL);
+	} else {
+		ctx->sigPart = 0;
+		if (!fmtSigHash(ctx)) {
+			// sendHashes has already reported the error.
+			ui_idle();
+			return;
+		}
+		ux_flow_init(0, ux_compare_hash_flow, NULL);
+	}
+}
+
+// showTxnEnd displays the screens that follow the last element of the
+// transaction: the totals, if a summary was requested, followed by the final
+// screen.
+static void showTxnEnd(void) {
+	if (ctx->summary) {
+		ctx->elemPart = 0;
+		fmtSummary(ctx);
+		ux_flow_init(0, ux_txn_summary_flow, NULL);
+	} else {
+		showFinal();
+	}
+}
+
+static unsigned int ui_calcTxnHash_summary_button(void) {
+	// As with the compare screen, the totals may belong to a transaction
+	// that has since been replaced; don't go on to show the new one's.
+	if (ctx->initialized || ctx->importing) {
+		ui_idle();
+		return 0;
+	}
+	ctx->elemPart++;
+	if (ctx->elemPart < 3) {
+		fmtSummary(ctx);
+		ux_flow_init(0, ux_txn_summary_flow, NULL);
+	} else {
+		showFinal();
+	}
+	return 0;
+}
+
+// decodeAhead decodes as many elements as the queue has room for. Elements
+// that are not displayed are hashed and skipped over; in summary and
+// hash-only mode, this includes every element. It returns TXN_STATE_PARTIAL once the current
+// packet has been fully consumed, or TXN_STATE_READY if the queue filled up
+// first.
+static txnDecoderState_e decodeAhead(void) {
+	while (ctx->queueLen < TXN_ELEM_QUEUE_LEN) {
+		txnDecoderState_e state = txn_next_elem(&ctx->txn);
+		if (state != TXN_STATE_READY) {
+			return state;
+		}
+		if (!ctx->summary && !ctx->hashOnly) {
+			ctx->queue[(ctx->queueHead + ctx->queueLen) % TXN_ELEM_QUEUE_LEN] = ctx->txn.elem;
+			ctx->queueLen++;
+		}
+	}
+	return TXN_STATE_READY;
+}
+
+// decodeInput is decodeAhead for the current packet as a whole. For
+// compressed transactions, it expands the packet into xbuf, one piece at a
+// time, as the decoder consumes it. The last op of a packet may expand to
+// more than fits in xbuf (e.g. a long run of zeros), so expansion continues
+// until the expander has nothing more to write, not just until the packet
+// is used up.
+static txnDecoderState_e decodeInput(void) {
+	for (;;) {
+		txnDecoderState_e state = decodeAhead();
+		if (state != TXN_STATE_PARTIAL || !ctx->compressed) {
+			return state;
+		}
+		int n = exp_expand(&ctx->exp, &ctx->zin, &ctx->zinlen, ctx->xbuf, sizeof(ctx->xbuf));
+		if (n < 0) {
+			return TXN_STATE_ERR;
+		} else if (n == 0) {
+			return state;
+		}
+		txn_update(&ctx->txn, ctx->xbuf, n);
+	}
+}
+
+// fmtValue formats the currency value of elem into fullStr as a decimal
+// string, returning its length.
+static int fmtValue(calcTxnHashContext_t *ctx, txn_elem_t *elem) {
+	cur_t c = {0};
+	cur_add(&c, elem->out.val, elem->out.valLen);
+	return cur_fmt(ctx->fullStr, &c);
 }
 
 // This is a helper function that prepares an element of the transaction for
 // display. It stores the type of the element in labelStr, and a human-
 // readable representation of the element in fullStr. As in previous screens,
 // partialStr holds the visible portion of fullStr.
-static void fmtTxnElem(calcTxnHashContext_t *ctx) {
-	txn_state_t *txn = &ctx->txn;
-
-	switch (txn->elemType) {
+static void fmtTxnElem(calcTxnHashContext_t *ctx, txn_elem_t *elem) {
+	switch (elem->type) {
 	case TXN_ELEM_SC_OUTPUT:
 		memmove(ctx->labelStr, "SC Output #", 11);
-		bin2dec(ctx->labelStr+16, txn->sliceIndex);
+		bin2dec(ctx->labelStr+11, elem->index);
 		// An element can have multiple screens. For each siacoin output, the
 		// user needs to see both the destination address and the amount.
 		// These are rendered in separate screens, and elemPart is used to
 		// identify which screen is being viewed.
 		if (ctx->elemPart == 0) {
-			memmove(ctx->fullStr, txn->outAddr, sizeof(txn->outAddr));
+			unlockHashToSiaAddress(ctx->fullStr, elem->out.hash);
 			ctx->elemPart++;
 		} else {
-			memmove(ctx->fullStr, txn->outVal, sizeof(txn->outVal));
-			formatSC(ctx->fullStr, txn->valLen);
+			formatSC(ctx->fullStr, fmtValue(ctx, elem));
 			ctx->elemPart = 0;
 		}
 		break;
 
 	case TXN_ELEM_SF_OUTPUT:
 		memmove(ctx->labelStr, "SF Output #", 11);
-		bin2dec(ctx->labelStr+16, txn->sliceIndex);
+		bin2dec(ctx->labelStr+11, elem->index);
 		if (ctx->elemPart == 0) {
-			memmove(ctx->fullStr, txn->outAddr, sizeof(txn->outAddr));
+			unlockHashToSiaAddress(ctx->fullStr, elem->out.hash);
 			ctx->elemPart++;
 		} else {
-			memmove(ctx->fullStr, txn->outVal, sizeof(txn->outVal));
-			memmove(ctx->fullStr+txn->valLen, " SF", 4);
+			memmove(ctx->fullStr+fmtValue(ctx, elem), " SF", 4);
 			ctx->elemPart = 0;
 		}
 		break;
@@ -146,12 +391,33 @@ static void fmtTxnElem(calcTxnHashContext_t *ctx) {
 	case TXN_ELEM_MINER_FEE:
 		// Miner fees only have one part.
 		memmove(ctx->labelStr, "Miner Fee #", 11);
-		bin2dec(ctx->labelStr+11, txn->sliceIndex);
-		memmove(ctx->fullStr, txn->outVal, sizeof(txn->outVal));
-		formatSC(ctx->fullStr, txn->valLen);
+		bin2dec(ctx->labelStr+11, elem->index);
+		formatSC(ctx->fullStr, fmtValue(ctx, elem));
 		ctx->elemPart = 0;
 		break;
 
+	case TXN_ELEM_ARB_DATA:
+		// Arbitrary data may be arbitrarily large, so we show its size,
+		// followed by a hex preview of the first few bytes.
+		memmove(ctx->labelStr, "Arb. Data #", 11);
+		bin2dec(ctx->labelStr+11, elem->index);
+		if (ctx->elemPart == 0) {
+			int n = bin2dec(ctx->fullStr, elem->arb.len);
+			memmove(ctx->fullStr+n, " bytes", 7);
+			// skip the preview if there's nothing to show
+			if (elem->arb.len > 0) {
+				ctx->elemPart++;
+			}
+		} else {
+			uint8_t n = (elem->arb.len < sizeof(elem->arb.preview)) ? elem->arb.len : sizeof(elem->arb.preview);
+			bin2hex(ctx->fullStr, elem->arb.preview, n);
+			if (elem->arb.len > n) {
+				memmove(ctx->fullStr+2*n, "...", 4);
+			}
+			ctx->elemPart = 0;
+		}
+		break;
+
 	default:
 		// This should never happen.
 		io_exchange_with_code(SW_DEVELOPER_ERR, 0);
@@ -160,72 +426,403 @@ static void fmtTxnElem(calcTxnHashContext_t *ctx) {
 	}
 }
 
+// showNextElem displays the first part of the element at the head of the
+// queue.
+static void showNextElem(void) {
+	ctx->showing = true;
+	ctx->elemPart = 0;
+	fmtTxnElem(ctx, &ctx->queue[ctx->queueHead]);
+	ux_flow_init(0, ux_show_txn_elem_flow, NULL);
+}
+
+// finishTxn is called once the transaction has been fully decoded and every
+// element has been displayed. If we're just computing the hashes, they are
+// sent immediately. Then the summary (if requested) is displayed, followed by
+// the approval screen or the comparison screen.
+static void finishTxn(void) {
+	ctx->replyPending = false;
+	// Reset the initialization state.
+	ctx->initialized = false;
+	if (!ctx->sign && !sendHashes()) {
+		ui_idle();
+		return;
+	}
+	showTxnEnd();
+}
+
 static unsigned int ui_calcTxnHash_elem_button(void) {
-		if (ctx->elemPart > 0) {
-			// We're in the middle of displaying a multi-part element; display
-			// the next part.
-			fmtTxnElem(ctx);
-		    ux_flow_init(0, ux_show_txn_elem_flow, NULL);
-		    return 0;
-		}
-		// Attempt to decode the next element in the transaction.
-		switch (txn_next_elem(&ctx->txn)) {
+	if (!ctx->showing) {
+		// The last element has already been reviewed, and we're waiting for
+		// the computer to send more data; there's nothing to do.
+		return 0;
+	}
+	if (ctx->elemPart > 0) {
+		// We're in the middle of displaying a multi-part element; display
+		// the next part.
+		fmtTxnElem(ctx, &ctx->queue[ctx->queueHead]);
+		ux_flow_init(0, ux_show_txn_elem_flow, NULL);
+		return 0;
+	}
+
+	// The element has been fully reviewed; remove it from the queue.
+	ctx->queueHead = (ctx->queueHead + 1) % TXN_ELEM_QUEUE_LEN;
+	ctx->queueLen--;
+	ctx->showing = false;
+
+	// If the last packet was left unacknowledged because the queue was
+	// full, there's now room to continue decoding it.
+	if (ctx->replyPending && !ctx->txn.finished) {
+		switch (decodeInput()) {
 		case TXN_STATE_ERR:
 			// The transaction is invalid.
 			io_exchange_with_code(SW_INVALID_PARAM, 0);
 			ui_idle();
-			break;
+			return 0;
 		case TXN_STATE_PARTIAL:
-			// We don't have enough data to decode the next element; send an
-			// OK code to request more.
+			// The packet has been fully consumed; request the next one.
+			// As in handleCalcTxnHash, this must precede ux_flow_init.
 			io_exchange_with_code(SW_OK, 0);
+			ctx->replyPending = false;
 			break;
 		case TXN_STATE_READY:
-			// We successively decoded one or more elements; display the first
-			// part of the first element.
-			ctx->elemPart = 0;
-			fmtTxnElem(ctx);
-		    ux_flow_init(0, ux_show_txn_elem_flow, NULL);
-			break;
 		case TXN_STATE_FINISHED:
-			// We've finished decoding the transaction, and all elements have
-			// been displayed.
-			if (ctx->sign) {
-				// If we're signing the transaction, prepare and display the
-				// approval screen.
-				memmove(ctx->fullStr, "with key #", 10);
-				memmove(ctx->fullStr+10+(bin2dec(ctx->fullStr+10, ctx->keyIndex)), "?", 2);
-			    ux_flow_init(0, ux_sign_txn_flow, NULL);
-
-			} else {
-				// If we're just computing the hash, send it immediately and
-				// display the comparison screen
-				memmove(G_io_apdu_buffer, ctx->txn.sigHash, 32);
-				io_exchange_with_code(SW_OK, 32);
-				bin2hex(ctx->fullStr, ctx->txn.sigHash, sizeof(ctx->txn.sigHash));
-				ux_flow_init(0, ux_compare_hash_flow, NULL);
-			}
-			// Reset the initialization state.
-			ctx->initialized = false;
+			// Either the queue is full again, or the rest of the
+			// transaction is queued.
 			break;
 		}
+	}
+
+	if (ctx->queueLen > 0) {
+		showNextElem();
+	} else if (ctx->txn.finished) {
+		finishTxn();
+	}
+	// Otherwise, the element stays on screen until more data arrives.
 	return 0;
 }
 
+// A continuation token holds the transaction's progress: the leading fields
+// of ctx (see sia_ux.h), followed by the decoder state.
+#define TOKEN_PARAMS_LEN offsetof(calcTxnHashContext_t, approved)
+#define TOKEN_STATE_LEN  (TOKEN_PARAMS_LEN + sizeof(txn_state_t))
+#define TOKEN_LEN        (TOKEN_NONCE_LEN + TOKEN_STATE_LEN + TOKEN_TAG_LEN)
+
+// tokenByte returns a pointer to the unencrypted byte i of a continuation
+// token, which lives in either ctx->tokenNonce, the progress fields of ctx,
+// or ctx->tokenTag.
+static uint8_t *tokenByte(uint16_t i) {
+	if (i < TOKEN_NONCE_LEN) {
+		return &ctx->tokenNonce[i];
+	}
+	i -= TOKEN_NONCE_LEN;
+	if (i < TOKEN_PARAMS_LEN) {
+		return (uint8_t *)ctx + i;
+	}
+	i -= TOKEN_PARAMS_LEN;
+	if (i < sizeof(txn_state_t)) {
+		return (uint8_t *)&ctx->txn + i;
+	}
+	return &ctx->tokenTag[i - sizeof(txn_state_t)];
+}
+
+// cryptToken encrypts or decrypts, in place, the len bytes of a continuation
+// token at buf, which begin at offset off within the token. Only the state is
+// encrypted; the nonce and tag are left alone.
+static void cryptToken(uint8_t *buf, uint16_t off, uint16_t len) {
+	uint16_t start = (off > TOKEN_NONCE_LEN) ? off : TOKEN_NONCE_LEN;
+	uint16_t end = (off + len < TOKEN_NONCE_LEN + TOKEN_STATE_LEN) ? off + len : TOKEN_NONCE_LEN + TOKEN_STATE_LEN;
+	if (start < end) {
+		token_crypt(ctx->tokenNonce, start - TOKEN_NONCE_LEN, buf + (start - off), end - start);
+	}
+}
+
+// tokenMAC calculates the authentication tag of the transaction's progress.
+static void tokenMAC(uint8_t *tag) {
+	token_mac(tag, ctx->tokenNonce, (uint8_t *)ctx, TOKEN_PARAMS_LEN, (uint8_t *)&ctx->txn, sizeof(txn_state_t));
+}
+
 // APDU parameters
 #define P1_FIRST        0x00 // 1st packet of multi-packet transfer
 #define P1_MORE         0x80 // nth packet of multi-packet transfer
+#define P1_NEXT         0x01 // fetch the next packet of a multi-packet response
+#define P1_REUSE        0x02 // calculate another SigHash of the last transaction
+#define P1_ABORT        0x03 // discard the current transaction
+#define P1_EXPORT       0x04 // save the transaction's progress in a token
+#define P1_IMPORT       0x05 // restore the transaction's progress from a token
 #define P2_DISPLAY_HASH 0x00 // display transaction hash
 #define P2_SIGN_HASH    0x01 // sign transaction hash
+#define P2_MULTI        0x02 // compute multiple SigHashes
+#define P2_SUMMARY      0x04 // display totals instead of individual elements
+#define P2_HASH_ONLY    0x08 // display nothing but the final hash
+#define P2_RESUMABLE    0x10 // P1_MORE packets begin with their offset
+#define P2_COMPRESSED   0x20 // transaction data is compressed
+#define P2_SIG_HEADERS  0x40 // only the requested TxnSig headers are sent
+#define P2_PARTIAL      0x80 // only the elements covered by the signature are sent
 
 // handleCalcTxnHash reads a signature index and a transaction, calculates the
 // SigHash of the transaction, and optionally signs the hash using a specified
 // key. The transaction is processed in a streaming fashion and displayed
 // piece-wise to the user.
+//
+// Decoding runs ahead of the display: displayable elements are queued (up to
+// TXN_ELEM_QUEUE_LEN of them), and each packet is acknowledged as soon as it
+// has been consumed, rather than once its elements have been reviewed. This
+// lets the computer keep sending while the user reviews, so the SigHash is
+// ready as soon as the last element is approved.
+//
+// If P2_MULTI is set, the first packet instead begins with a count, followed
+// by that many (key index, sig index) pairs, and the SigHash of each is
+// computed in a single pass over the transaction. When signing, the user
+// approves all of the signatures at once; if they do not fit in a single
+// response, the computer fetches the rest with P1_NEXT.
+//
+// If P2_SUMMARY is set, the individual outputs and miner fees are not
+// displayed; instead, the user is shown their totals at the end of the
+// transaction. For transactions with hundreds of outputs, this is the only
+// practical way to review them.
+//
+// If P2_HASH_ONLY is set, nothing is displayed until the transaction has
+// been fully decoded, at which point the SigHash is sent and the comparison
+// screen is shown. This is only allowed when not signing, since there is
+// nothing for the user to approve; it allows the computer to calculate
+// SigHashes as fast as it can send transactions.
+//
+// If P2_RESUMABLE is set, each P1_MORE packet begins with the 4-byte offset
+// of its data within the transaction (not counting the indices in the first
+// packet). Data that was already received is skipped, so a packet can safely
+// be resent if its response was lost. If the offset is past the end of the
+// data received so far (i.e. a packet was dropped), the handler responds
+// with SW_BAD_OFFSET and the offset it expected, from which the computer can
+// resume.
+//
+// If P2_COMPRESSED is set, the transaction data (but not the indices in the
+// first packet) is compressed as described in expand.c. Offsets then refer
+// to the compressed data.
+//
+// If P2_SIG_HEADERS is set, the TransactionSignatures are abridged: their
+// length prefix is followed only by the 48-byte header (ParentID,
+// PublicKeyIndex, and Timelock) of each requested signature, in order. The
+// headers are all that a SigHash covers, and transactions with many inputs
+// have many signatures, so this can save a good deal of uploading. The
+// length prefix is still checked against the sig indices, but since the
+// CoveredFields are not sent, they are not checked to be WholeTransaction;
+// if the computer lies about them, the result is just an invalid signature.
+//
+// If P2_PARTIAL is set, the SigHash is calculated for a signature whose
+// CoveredFields list individual elements rather than setting
+// WholeTransaction. Such a SigHash covers nothing but the listed elements,
+// concatenated in the order they are listed, so that's all the computer
+// sends: a transaction made up of just the covered elements. (The slice
+// length prefixes are needed to decode it, but are not hashed, and covered
+// TransactionSignatures are hashed in full.) The user reviews only the
+// covered outputs, numbered by their position among them, so a co-signer of
+// a large transaction need only upload and review their share of it. Only
+// one SigHash can be calculated this way per transaction.
+//
+// P1_ABORT discards the current transaction and returns to the main menu,
+// allowing a new one to be sent. The computer should use it after an upload
+// fails, e.g. if it crashed.
+//
+// P1_EXPORT saves the progress of the current transaction in a continuation
+// token, which the computer can later pass back with P1_IMPORT to pick up
+// where it left off -- after crashing, say, or after using the device for
+// something else. The token is encrypted and authenticated under a key that
+// never leaves the device, and is valid until the app exits. Progress can
+// only be saved between packets, once every element decoded so far has been
+// reviewed. Each P1_EXPORT packet contains the 2-byte offset of the part of
+// the token to return; an empty response marks the end of the token. (The
+// token is generated afresh when offset 0 is requested.) Each P1_IMPORT
+// packet contains a 2-byte offset, followed by the next part of the token.
+// Once the entire token has been received and verified, the handler responds
+// with the offset of the transaction data that should be sent next. P1_FIRST
+// and P1_ABORT abandon an import that is in progress.
+//
+// Once a transaction has been fully decoded, P1_REUSE requests the SigHash
+// of another of its signatures, given a key index and sig index, without
+// sending the transaction again. This works for any signature whose header
+// the decoder kept: all of the requested ones, plus the first few others, up
+// to TXN_MAX_SIGS in total. (With P2_SIG_HEADERS, only the requested
+// headers are available.) When signing, the key index must be one of those
+// the user approved for the transaction.
 void handleCalcTxnHash(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
-	if ((p1 != P1_FIRST && p1 != P1_MORE) || (p2 != P2_DISPLAY_HASH && p2 != P2_SIGN_HASH)) {
+	// If we haven't responded to the previous packet yet, the computer must
+	// have given up waiting and sent another command. The decoder may still
+	// be reading from the previous packet, which has now been overwritten,
+	// so the transaction can't be continued. Drop it, and refuse the command
+	// (unless it was P1_ABORT, which asked for just that).
+	if (ctx->replyPending) {
+		ctx->initialized = false;
+		ctx->replyPending = false;
+		if (p1 != P1_ABORT) {
+			io_exchange_with_code(SW_IMPROPER_INIT, 0);
+			ui_idle();
+			return;
+		}
+	}
+
+	if ((p1 != P1_MORE && p1 > P1_IMPORT) || (p2 & ~(P2_SIGN_HASH | P2_MULTI | P2_SUMMARY | P2_HASH_ONLY | P2_RESUMABLE | P2_COMPRESSED | P2_SIG_HEADERS | P2_PARTIAL))) {
 		THROW(SW_INVALID_PARAM);
 	}
+	if ((p2 & P2_HASH_ONLY) && (p2 & (P2_SIGN_HASH | P2_SUMMARY))) {
+		THROW(SW_INVALID_PARAM);
+	}
+	if ((p2 & P2_PARTIAL) && (p2 & (P2_MULTI | P2_SIG_HEADERS))) {
+		THROW(SW_INVALID_PARAM);
+	}
+
+	if (p1 == P1_ABORT) {
+		// Forget the transaction, along with any approval the user gave for
+		// it. If one of its screens is displayed, replace it with the main
+		// menu (after responding, as usual).
+		ctx->initialized = false;
+		ctx->approved = false;
+		ctx->reviewed = false;
+		ctx->importing = false;
+		ctx->tokenPos = 0;
+		clearSigningKey();
+		io_exchange_with_code(SW_OK, 0);
+		ui_idle();
+		return;
+	}
+
+	if (p1 == P1_EXPORT) {
+		if (dataLength != 2) {
+			THROW(SW_INVALID_PARAM);
+		}
+		// We can only save the decoder's state when nothing is waiting to
+		// be reviewed. (It isn't holding onto a packet; see above.)
+		if (!ctx->initialized || ctx->queueLen > 0) {
+			THROW(SW_IMPROPER_INIT);
+		}
+		uint16_t off = U2LE(dataBuffer, 0);
+		if (off == 0) {
+			ctx->txn.in = NULL; // dangling, since the packet was consumed
+			token_nonce(ctx->tokenNonce);
+			tokenMAC(ctx->tokenTag);
+		}
+		uint16_t n = 0;
+		while (off + n < TOKEN_LEN && n < sizeof(G_io_apdu_buffer) - 2) {
+			G_io_apdu_buffer[n] = *tokenByte(off + n);
+			n++;
+		}
+		cryptToken(G_io_apdu_buffer, off, n);
+		*tx = n;
+		THROW(SW_OK);
+	}
+
+	if (p1 == P1_IMPORT) {
+		if (dataLength < 2) {
+			THROW(SW_INVALID_PARAM);
+		}
+		uint16_t off = U2LE(dataBuffer, 0);
+		dataBuffer += 2; dataLength -= 2;
+		if (off == 0) {
+			// Discard the current transaction, as with P1_ABORT. Until the
+			// token is verified, ctx holds attacker-controlled data, so
+			// nothing may use it.
+			ctx->initialized = false;
+			ctx->approved = false;
+			ctx->reviewed = false;
+			clearSigningKey();
+			ctx->queueLen = 0;
+			ctx->showing = false;
+			ctx->replyPending = false;
+			ctx->importing = true;
+			ctx->tokenPos = 0;
+		}
+		if (!ctx->importing || off != ctx->tokenPos || dataLength > TOKEN_LEN - off) {
+			memset(ctx, 0, sizeof(*ctx));
+			THROW(SW_INVALID_PARAM);
+		}
+		// Decrypt in place, then copy into ctx. The nonce must be copied
+		// first, since it's needed for decryption.
+		for (uint16_t i = 0; i < dataLength && off + i < TOKEN_NONCE_LEN; i++) {
+			ctx->tokenNonce[off + i] = dataBuffer[i];
+		}
+		cryptToken(dataBuffer, off, dataLength);
+		for (uint16_t i = 0; i < dataLength; i++) {
+			*tokenByte(off + i) = dataBuffer[i];
+		}
+		ctx->tokenPos += dataLength;
+
+		uint16_t n = 0;
+		if (ctx->tokenPos == TOKEN_LEN) {
+			// Verify the token, comparing tags in constant time.
+			uint8_t tag[TOKEN_TAG_LEN];
+			tokenMAC(tag);
+			uint8_t diff = 0;
+			for (int i = 0; i < TOKEN_TAG_LEN; i++) {
+				diff |= tag[i] ^ ctx->tokenTag[i];
+			}
+			if (diff != 0) {
+				memset(ctx, 0, sizeof(*ctx));
+				THROW(SW_INVALID_PARAM);
+			}
+			ctx->importing = false;
+			ctx->initialized = true;
+			// Tell the computer where to resume.
+			G_io_apdu_buffer[0] = ctx->offset & 0xFF;
+			G_io_apdu_buffer[1] = (ctx->offset >> 8) & 0xFF;
+			G_io_apdu_buffer[2] = (ctx->offset >> 16) & 0xFF;
+			G_io_apdu_buffer[3] = ctx->offset >> 24;
+			n = 4;
+		}
+		if (off == 0) {
+			// Leave whatever screen was displayed, since it may refer to
+			// ctx.
+			io_exchange_with_code(SW_OK, n);
+			ui_idle();
+			return;
+		}
+		*tx = n;
+		THROW(SW_OK);
+	}
+
+	if (p1 == P1_REUSE) {
+		// The decoder keeps the hash of everything preceding the
+		// TransactionSignatures, which is the same for every SigHash, so
+		// only the requested signature's header needs to be hashed. Since
+		// the transaction is unchanged, we don't ask the user to review it
+		// again; but we only sign if they approved signing it the first
+		// time, and only with one of the keys they approved.
+		if (dataLength != 6 || (p2 & P2_MULTI)) {
+			THROW(SW_INVALID_PARAM);
+		}
+		if (((p2 & P2_SIGN_HASH) && !ctx->reviewed) || ctx->importing) {
+			THROW(SW_IMPROPER_INIT);
+		}
+		uint32_t keyIndex = U4LE(dataBuffer, 0);
+		if (p2 & P2_SIGN_HASH) {
+			bool approvedKey = false;
+			for (int i = 0; i < ctx->txn.numSigs; i++) {
+				approvedKey |= (ctx->keyIndices[i] == keyIndex);
+			}
+			if (!approvedKey) {
+				THROW(SW_INVALID_PARAM);
+			}
+		}
+		uint8_t hash[32];
+		if (!txn_sighash(&ctx->txn, U2LE(dataBuffer, 4), hash)) {
+			THROW(SW_IMPROPER_INIT);
+		}
+		if (p2 & P2_SIGN_HASH) {
+			deriveAndSign(G_io_apdu_buffer, keyIndex, hash);
+			*tx = 64;
+		} else {
+			memmove(G_io_apdu_buffer, hash, 32);
+			*tx = 32;
+		}
+		THROW(SW_OK);
+	}
+
+	if (p1 == P1_NEXT) {
+		// The user has already approved the signatures; send the next batch.
+		if (!ctx->approved) {
+			THROW(SW_IMPROPER_INIT);
+		}
+		sendSigs();
+		return;
+	}
 
 	if (p1 == P1_FIRST) {
 		// If this is the first packet of a transaction, the transaction
@@ -237,140 +834,231 @@ void handleCalcTxnHash(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dat
 			THROW(SW_IMPROPER_INIT);
 		}
 		ctx->initialized = true;
+		// The previous transaction's final screens may still be displayed.
+		// Any approval given there must not carry over to this transaction,
+		// so dismiss them.
+		ui_idle();
 
 		// If this is the first packet, it will include the key index and sig
-		// index in addition to the transaction data. Use these to initialize
-		// the ctx and the transaction decoder.
-		ctx->keyIndex = U4LE(dataBuffer, 0); // NOTE: ignored if !ctx->sign
-		dataBuffer += 4; dataLength -= 4;
-		uint16_t sigIndex = U2LE(dataBuffer, 0);
-		dataBuffer += 2; dataLength -= 2;
-		txn_init(&ctx->txn, sigIndex);
+		// index (or, with P2_MULTI, a list of them) in addition to the
+		// transaction data. Use these to initialize the ctx and the
+		// transaction decoder.
+		uint8_t numSigs = 1;
+		if (p2 & P2_MULTI) {
+			if (dataLength < 1) {
+				ctx->initialized = false;
+				THROW(SW_INVALID_PARAM);
+			}
+			numSigs = dataBuffer[0];
+			dataBuffer += 1; dataLength -= 1;
+		}
+		if (numSigs == 0 || numSigs > TXN_MAX_SIGS || dataLength < numSigs*6) {
+			ctx->initialized = false;
+			THROW(SW_INVALID_PARAM);
+		}
+		uint16_t sigIndices[TXN_MAX_SIGS];
+		for (int i = 0; i < numSigs; i++) {
+			ctx->keyIndices[i] = U4LE(dataBuffer, 0); // NOTE: ignored if !ctx->sign
+			dataBuffer += 4; dataLength -= 4;
+			sigIndices[i] = U2LE(dataBuffer, 0);
+			dataBuffer += 2; dataLength -= 2;
+			// the decoder requires sig indices in ascending order
+			if (i > 0 && sigIndices[i] <= sigIndices[i-1]) {
+				ctx->initialized = false;
+				THROW(SW_INVALID_PARAM);
+			}
+		}
+		txnMode_e mode = TXN_MODE_WHOLE;
+		if (p2 & P2_SIG_HEADERS) {
+			mode = TXN_MODE_SIG_HEADERS;
+		} else if (p2 & P2_PARTIAL) {
+			mode = TXN_MODE_PARTIAL;
+		}
+		txn_init(&ctx->txn, sigIndices, numSigs, mode);
 
-		// Set ctx->sign according to P2.
+		// Set ctx->sign, ctx->summary, and ctx->hashOnly according to P2.
 		ctx->sign = (p2 & P2_SIGN_HASH);
+		ctx->summary = (p2 & P2_SUMMARY);
+		ctx->hashOnly = (p2 & P2_HASH_ONLY);
+		ctx->resumable = (p2 & P2_RESUMABLE);
+		ctx->compressed = (p2 & P2_COMPRESSED);
+		exp_init(&ctx->exp);
+
+		// The user will spend a while reviewing the transaction, so derive
+		// the (first) signing key now rather than after they approve it. If
+		// the derivation throws, the transaction must be started over.
+		if (ctx->sign) {
+			ctx->initialized = false;
+			prepareSigningKey(ctx->keyIndices[0]);
+			ctx->initialized = true;
+		} else {
+			clearSigningKey();
+		}
+		ctx->offset = 0;
 
 		ctx->elemPart = 0;
+		ctx->approved = false;
+		ctx->reviewed = false;
+		// A token that was being imported has been abandoned.
+		ctx->importing = false;
+		ctx->tokenPos = 0;
+		ctx->queueHead = 0;
+		ctx->queueLen = 0;
+		ctx->showing = false;
+		ctx->replyPending = false;
 	} else {
 		// If this is not P1_FIRST, the transaction must have been
 		// initialized previously.
 		if (!ctx->initialized) {
 			THROW(SW_IMPROPER_INIT);
 		}
+		if (ctx->resumable) {
+			if (dataLength < 4) {
+				THROW(SW_INVALID_PARAM);
+			}
+			uint32_t offset = U4LE(dataBuffer, 0);
+			dataBuffer += 4; dataLength -= 4;
+			if (offset > ctx->offset) {
+				// Some data is missing; tell the computer where to resume.
+				G_io_apdu_buffer[0] = ctx->offset & 0xFF;
+				G_io_apdu_buffer[1] = (ctx->offset >> 8) & 0xFF;
+				G_io_apdu_buffer[2] = (ctx->offset >> 16) & 0xFF;
+				G_io_apdu_buffer[3] = ctx->offset >> 24;
+				*tx = 4;
+				THROW(SW_BAD_OFFSET);
+			}
+			// Skip whatever we've already received. If that's everything,
+			// this is a duplicate packet; acknowledge it again.
+			uint32_t seen = ctx->offset - offset;
+			if (seen >= dataLength) {
+				THROW(SW_OK);
+			}
+			dataBuffer += seen; dataLength -= seen;
+		}
 	}
+	ctx->offset += dataLength;
 
-	// Add the new data to transaction decoder.
-	txn_update(&ctx->txn, dataBuffer, dataLength);
+	// Add the new data to transaction decoder. The decoder parses elements
+	// directly out of dataBuffer (i.e. G_io_apdu_buffer), so we must not
+	// overwrite G_io_apdu_buffer until txn_next_elem returns
+	// TXN_STATE_PARTIAL; at that point, any unfinished tail has been copied
+	// into the decoder. Compressed data is fed to the decoder by decodeInput
+	// instead, but the same rule applies.
+	if (ctx->compressed) {
+		ctx->zin = dataBuffer;
+		ctx->zinlen = dataLength;
+	} else {
+		txn_update(&ctx->txn, dataBuffer, dataLength);
+	}
 
-	// Attempt to decode the next element of the transaction. Note that this
-	// code is essentially identical to ui_calcTxnHash_elem_button. Sadly,
-	// there doesn't seem to be a clean way to avoid this duplication.
-	switch (txn_next_elem(&ctx->txn)) {
-	case TXN_STATE_ERR:
+	// Decode as far ahead as the queue allows. If the whole packet is
+	// consumed, we acknowledge it right away -- even if an element is still
+	// on screen -- so that the computer can send the next packet while the
+	// user is reviewing. Otherwise, the queue is full, and the reply is
+	// deferred until the user makes room (see ui_calcTxnHash_elem_button).
+	txnDecoderState_e state = decodeInput();
+	if (state == TXN_STATE_ERR) {
 		THROW(SW_INVALID_PARAM);
-	case TXN_STATE_PARTIAL:
-		THROW(SW_OK);
-	case TXN_STATE_READY:
-		ctx->elemPart = 0;
-		fmtTxnElem(ctx);
-		ux_flow_init(0, ux_show_txn_elem_flow, NULL);
-		*flags |= IO_ASYNCH_REPLY;
-		break;
-	case TXN_STATE_FINISHED:
+	}
+	bool show = !ctx->showing && ctx->queueLen > 0;
+	if (state == TXN_STATE_PARTIAL) {
+		if (!show) {
+			THROW(SW_OK);
+		}
+		io_exchange_with_code(SW_OK, 0);
+		showNextElem();
+		// The above code does something strange: it calls io_exchange
+		// directly from the command handler. You might wonder: why not just
+		// prepare the APDU buffer and let sia_main call io_exchange?
+		// The answer, surprisingly, is that we also need to call
+		// UX_DISPLAY, and UX_DISPLAY affects io_exchange in subtle ways.
+		// To understand why, we'll need to dive deep into the Nano S
+		// firmware. I recommend that you don't skip this section, even
+		// though it's lengthy, because it will save you a lot of
+		// frustration when you go "off the beaten path" in your own app.
+		//
+		// Recall that the Nano S has two chips. Your app (and the Ledger
+		// OS, BOLOS) runs on the Secure Element. The SE is completely
+		// self-contained; it doesn't talk to the outside world at all. It
+		// only talks to the other chip, the MCU. The MCU is what
+		// processes button presses, renders things on screen, and
+		// exchanges APDU packets with the computer. The communication
+		// layer between the SE and the MCU is called SEPROXYHAL. There
+		// are some nice diagrams in the "Hardware Architecture" section
+		// of Ledger's docs that will help you visualize all this.
+		//
+		// The SEPROXYHAL protocol, like any communication protocol,
+		// specifies exactly when each party is allowed to talk.
+		// Communication happens in a loop: first the MCU sends an Event,
+		// then the SE replies with zero or more Commands, and finally the
+		// SE sends a Status to indicate that it has finished processing
+		// the Event, completing one iteration:
+		//
+		//    Event -> Commands -> Status -> Event -> Commands -> ...
+		//
+		// For our purposes, an "Event" is a request APDU, and a "Command"
+		// is a response APDU. (There are other types of Events and
+		// Commands, such as button presses, but they aren't relevant
+		// here.) As for the Status, there is a "General" Status and a
+		// "Display" Status. A General Status tells the MCU to send the
+		// response APDU, and a Display Status tells it to render an
+		// element on the screen. Remember, it's "zero or more Commands,"
+		// so it's legal to send just a Status without any Commands.
+		//
+		// You may have some picture of the problem now. Imagine we
+		// prepare the APDU buffer, then call UX_DISPLAY, and then let
+		// sia_main send the APDU with io_exchange. What happens at the
+		// SEPROXYHAL layer? First, UX_DISPLAY will send a Display Status.
+		// Then, io_exchange will send a Command and a General Status. But
+		// no Event was processed between the two Statuses! This causes
+		// SEPROXYHAL to freak out and crash, forcing you to reboot your
+		// Nano S.
+		//
+		// So why does calling io_exchange before UX_DISPLAY fix the
+		// problem? Won't we just end up sending two Statuses again? The
+		// secret is that io_exchange_with_code uses the
+		// IO_RETURN_AFTER_TX flag. Previously, the only thing we needed
+		// to know about IO_RETURN_AFTER_TX is that it sends a response
+		// APDU without waiting for the next request APDU. But it has one
+		// other important property: it tells io_exchange not to send a
+		// Status! So the only Status we send comes from UX_DISPLAY. This
+		// preserves the ordering required by SEPROXYHAL.
+		//
+		// Lastly: what if we prepare the APDU buffer in the handler, but
+		// with the IO_RETURN_AFTER_TX flag set? Will that work?
+		// Unfortunately not. io_exchange won't send a status, but it
+		// *will* send a Command containing the APDU, so we still end up
+		// breaking the correct SEPROXYHAL ordering.
+		//
+		// Here's a list of rules that will help you debug similar issues:
+		//
+		// - Always preserve the order: Event -> Commands -> Status
+		// - UX_DISPLAY sends a Status
+		// - io_exchange sends a Command and a Status
+		// - IO_RETURN_AFTER_TX makes io_exchange not send a Status
+		// - IO_ASYNCH_REPLY (or tx=0) makes io_exchange not send a Command
+		//
+		// Okay, that second rule isn't 100% accurate. UX_DISPLAY doesn't
+		// necessarily send a single Status: it sends a separate Status
+		// for each element you render! The reason this works is that the
+		// MCU replies to each Display Status with a Display Processed
+		// Event. That means you can call UX_DISPLAY many times in a row
+		// without disrupting SEPROXYHAL. Anyway, as far as we're
+		// concerned, it's simpler to think of UX_DISPLAY as sending just
+		// a single Status.
+	} else if (state == TXN_STATE_FINISHED && ctx->queueLen == 0 && !ctx->showing) {
+		// Every element has already been reviewed. As above, if we're not
+		// signing, finishTxn sends the hashes before displaying anything.
+		finishTxn();
 		if (ctx->sign) {
-			memmove(ctx->fullStr, "with key #", 10);
-			bin2dec(ctx->fullStr+10, ctx->keyIndex);
-			memmove(ctx->fullStr+10+(bin2dec(ctx->fullStr+10, ctx->keyIndex)), "?", 2);
-			ux_flow_init(0, ux_sign_txn_flow, NULL);
 			*flags |= IO_ASYNCH_REPLY;
-		} else {
-			memmove(G_io_apdu_buffer, ctx->txn.sigHash, 32);
-			io_exchange_with_code(SW_OK, 32);
-			bin2hex(ctx->fullStr, ctx->txn.sigHash, sizeof(ctx->txn.sigHash));
-			ux_flow_init(0, ux_compare_hash_flow, NULL);
-			// The above code does something strange: it calls io_exchange
-			// directly from the command handler. You might wonder: why not
-			// just prepare the APDU buffer and let sia_main call io_exchange?
-			// The answer, surprisingly, is that we also need to call
-			// UX_DISPLAY, and UX_DISPLAY affects io_exchange in subtle ways.
-			// To understand why, we'll need to dive deep into the Nano S
-			// firmware. I recommend that you don't skip this section, even
-			// though it's lengthy, because it will save you a lot of
-			// frustration when you go "off the beaten path" in your own app.
-			//
-			// Recall that the Nano S has two chips. Your app (and the Ledger
-			// OS, BOLOS) runs on the Secure Element. The SE is completely
-			// self-contained; it doesn't talk to the outside world at all. It
-			// only talks to the other chip, the MCU. The MCU is what
-			// processes button presses, renders things on screen, and
-			// exchanges APDU packets with the computer. The communication
-			// layer between the SE and the MCU is called SEPROXYHAL. There
-			// are some nice diagrams in the "Hardware Architecture" section
-			// of Ledger's docs that will help you visualize all this.
-			//
-			// The SEPROXYHAL protocol, like any communication protocol,
-			// specifies exactly when each party is allowed to talk.
-			// Communication happens in a loop: first the MCU sends an Event,
-			// then the SE replies with zero or more Commands, and finally the
-			// SE sends a Status to indicate that it has finished processing
-			// the Event, completing one iteration:
-			//
-			//    Event -> Commands -> Status -> Event -> Commands -> ...
-			//
-			// For our purposes, an "Event" is a request APDU, and a "Command"
-			// is a response APDU. (There are other types of Events and
-			// Commands, such as button presses, but they aren't relevant
-			// here.) As for the Status, there is a "General" Status and a
-			// "Display" Status. A General Status tells the MCU to send the
-			// response APDU, and a Display Status tells it to render an
-			// element on the screen. Remember, it's "zero or more Commands,"
-			// so it's legal to send just a Status without any Commands.
-			//
-			// You may have some picture of the problem now. Imagine we
-			// prepare the APDU buffer, then call UX_DISPLAY, and then let
-			// sia_main send the APDU with io_exchange. What happens at the
-			// SEPROXYHAL layer? First, UX_DISPLAY will send a Display Status.
-			// Then, io_exchange will send a Command and a General Status. But
-			// no Event was processed between the two Statuses! This causes
-			// SEPROXYHAL to freak out and crash, forcing you to reboot your
-			// Nano S.
-			//
-			// So why does calling io_exchange before UX_DISPLAY fix the
-			// problem? Won't we just end up sending two Statuses again? The
-			// secret is that io_exchange_with_code uses the
-			// IO_RETURN_AFTER_TX flag. Previously, the only thing we needed
-			// to know about IO_RETURN_AFTER_TX is that it sends a response
-			// APDU without waiting for the next request APDU. But it has one
-			// other important property: it tells io_exchange not to send a
-			// Status! So the only Status we send comes from UX_DISPLAY. This
-			// preserves the ordering required by SEPROXYHAL.
-			//
-			// Lastly: what if we prepare the APDU buffer in the handler, but
-			// with the IO_RETURN_AFTER_TX flag set? Will that work?
-			// Unfortunately not. io_exchange won't send a status, but it
-			// *will* send a Command containing the APDU, so we still end up
-			// breaking the correct SEPROXYHAL ordering.
-			//
-			// Here's a list of rules that will help you debug similar issues:
-			//
-			// - Always preserve the order: Event -> Commands -> Status
-			// - UX_DISPLAY sends a Status
-			// - io_exchange sends a Command and a Status
-			// - IO_RETURN_AFTER_TX makes io_exchange not send a Status
-			// - IO_ASYNCH_REPLY (or tx=0) makes io_exchange not send a Command
-			//
-			// Okay, that second rule isn't 100% accurate. UX_DISPLAY doesn't
-			// necessarily send a single Status: it sends a separate Status
-			// for each element you render! The reason this works is that the
-			// MCU replies to each Display Status with a Display Processed
-			// Event. That means you can call UX_DISPLAY many times in a row
-			// without disrupting SEPROXYHAL. Anyway, as far as we're
-			// concerned, it's simpler to think of UX_DISPLAY as sending just
-			// a single Status.
-		}
-		// Reset the initialization state.
-		ctx->initialized = false;
-		break;
+		}
+	} else {
+		if (show) {
+			showNextElem();
+		}
+		ctx->replyPending = true;
+		*flags |= IO_ASYNCH_REPLY;
 	}
 }
 
@@ -0,0 +1,151 @@
+// This file contains a small fixed-width big-integer type for currency values.
+// Sia currency values are arbitrary-precision integers, but in practice they
+// never exceed 18 bytes (readCurrency in txn.c rejects longer ones), so a
+// 192-bit integer can hold the sum of any number of them that could fit in a
+// transaction. This allows the decoder to keep running totals, which can be
+// displayed in place of the individual outputs.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <os.h>
+#include "blake2b.h"
+#include "sia.h"
+
+bool cur_add(cur_t *sum, const uint8_t *val, uint8_t len) {
+	if (len > 8*CUR_WORDS) {
+		return false;
+	}
+	uint64_t carry = 0;
+	for (int i = 0; i < CUR_WORDS; i++) {
+		// load the i'th least-significant word of the big-endian val
+		uint64_t w = 0;
+		for (int j = 0; j < 8 && 8*i+j < len; j++) {
+			w |= (uint64_t)val[len-1-(8*i+j)] << (8*j);
+		}
+		uint64_t s = sum->w[i] + w;
+		uint64_t c = (s < w);
+		s += carry;
+		c |= (s < carry);
+		sum->w[i] = s;
+		carry = c;
+	}
+	return carry == 0;
+}
+
+// divWW returns the quotient and remainder of (u1<<64 | u0) / v, where v
+// must have its top bit set and u1 must be less than v. This is Algorithm D
+// from Knuth (via Go's math/big), specialized for a single-word divisor.
+static void divWW(uint64_t u1, uint64_t u0, uint64_t v, uint64_t *q, uint64_t *r) {
+	const uint64_t _B2 = 4294967296ULL;
+	uint64_t vn1 = v >> 32;
+	uint64_t vn0 = v & (_B2-1);
+	uint64_t un1 = u0 >> 32;
+	uint64_t un0 = u0 & (_B2-1);
+	uint64_t q1 = u1 / vn1;
+	uint64_t rhat = u1 - q1*vn1;
+
+	while (q1 >= _B2 || q1*vn0 > _B2*rhat + un1) {
+		q1--;
+		rhat += vn1;
+		if (rhat >= _B2) {
+			break;
+		}
+	}
+
+	uint64_t un21 = u1*_B2 + un1 - q1*v;
+	uint64_t q0 = un21 / vn1;
+	rhat = un21 - q0*vn1;
+
+	while (q0 >= _B2 || q0*vn0 > _B2*rhat + un0) {
+		q0--;
+		rhat += vn1;
+		if (rhat >= _B2) {
+			break;
+		}
+	}
+
+	*q = q1*_B2 + q0;
+	*r = un21*_B2 + un0 - q0*v;
+}
+
+// 10^19 is the largest power of 10 that fits in a uint64_t. Conveniently, its
+// top bit is set, so it can be used as a divWW divisor without normalization.
+#define POW10_19 10000000000000000000ULL
+#define POW10_18 1000000000000000000ULL
+#define POW10_9  1000000000ULL
+
+// quorem10_19 divides nat by 10^19 in place, returning the remainder.
+static uint64_t quorem10_19(uint64_t nat[], int len) {
+	uint64_t r = 0;
+	for (int i = len - 1; i >= 0; i--) {
+		divWW(r, nat[i], POW10_19, &nat[i], &r);
+	}
+	return r;
+}
+
+// putDigits writes x in decimal into buf, right-to-left, ending just before
+// buf[i] and zero-padded to at least n digits. It returns the index of the
+// first digit written.
+static int putDigits(uint8_t *buf, int i, uint32_t x, int n) {
+	do {
+		buf[--i] = '0' + (x % 10);
+		x /= 10;
+	} while (--n > 0 || x != 0);
+	return i;
+}
+
+int cur_fmt(uint8_t *out, const cur_t *c) {
+	uint64_t nat[CUR_WORDS];
+	memmove(nat, c->w, sizeof(nat));
+	int len = CUR_WORDS;
+	while (len > 0 && nat[len-1] == 0) {
+		len--;
+	}
+	if (len == 0) {
+		// As with the old cur2dec, which formatted the Sia encoding of zero
+		// (no bytes at all), zero is the empty string.
+		out[0] = '\0';
+		return 0;
+	}
+
+	// decode digits into buf, right-to-left, 19 at a time. Dividing by 10^19
+	// instead of 10 means that a 192-bit value needs at most 4 passes of
+	// (slow) 64-bit division, rather than one pass per digit. Each 19-digit
+	// chunk is then split into pieces small enough to be formatted with
+	// 32-bit arithmetic.
+	//
+	// NOTE: buf must be large enough to hold 4 chunks, i.e. 76 digits.
+	uint8_t buf[80];
+	int i = sizeof(buf);
+	buf[--i] = '\0';
+	while (len > 0) {
+		uint64_t r = quorem10_19(nat, len);
+		// normalize nat
+		while (len > 0 && nat[len-1] == 0) {
+			len--;
+		}
+		uint32_t top = 0;
+		while (r >= POW10_18) {
+			r -= POW10_18;
+			top++;
+		}
+		uint32_t mid = r / POW10_9;
+		uint32_t lo = r - mid*POW10_9;
+		// only the most-significant chunk is written without leading zeros
+		if (len > 0 || top > 0) {
+			i = putDigits(buf, i, lo, 9);
+			i = putDigits(buf, i, mid, 9);
+			i = putDigits(buf, i, top, 1);
+		} else if (mid > 0) {
+			i = putDigits(buf, i, lo, 9);
+			i = putDigits(buf, i, mid, 1);
+		} else {
+			i = putDigits(buf, i, lo, 1);
+		}
+	}
+
+	// copy buf->out, trimming whitespace
+	memmove(out, buf+i, sizeof(buf)-i);
+	return sizeof(buf)-i-1;
+}
@@ -0,0 +1,104 @@
+// This file contains the expander for compressed transaction uploads (see
+// P2_COMPRESSED in calcTxnHash.c). Sia transactions are full of repetition:
+// every input spends from the same few addresses, so the same public keys
+// and "ed25519" specifiers appear over and over, and most integers are
+// padded to 8 bytes with zeros. Over a slow link (e.g. Bluetooth on the Nano
+// X), it pays to not send all of that.
+//
+// The compressed stream is a sequence of ops, each of which begins with an
+// opcode byte:
+//
+//    0x00-0x7F  literal: the next (op+1) bytes are copied to the output
+//    0x80-0xBF  zeros: (op-0x7F) zero bytes are written to the output
+//    0xC0-0xDF  define: like a literal of ((op&0x1F)+1) bytes, but the bytes
+//               are also stored in the next dictionary slot
+//    0xE0-0xE7  reference: the contents of dictionary slot (op-0xE0) are
+//               written to the output
+//
+// Dictionary slots are assigned round-robin, so the computer always knows
+// which slot a definition will replace, given the number of slots (8, or 4 on
+// the Nano S), which it learns from getVersion. Ops may be split across
+// packets.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <os.h>
+#include "blake2b.h"
+#include "sia.h"
+
+#define OP_ZEROS  0x80
+#define OP_DEFINE 0xC0
+#define OP_REF    0xE0
+
+void exp_init(exp_state_t *e) {
+	memset(e, 0, sizeof(exp_state_t));
+}
+
+// beginOp reads an opcode, returning false if it is invalid.
+static bool beginOp(exp_state_t *e, uint8_t op) {
+	e->op = op;
+	e->done = 0;
+	if (op < OP_ZEROS) {
+		e->len = op + 1;
+	} else if (op < OP_DEFINE) {
+		e->len = op - OP_ZEROS + 1;
+	} else if (op < OP_REF) {
+		e->len = (op & 0x1F) + 1;
+		e->slot = e->nextSlot;
+		e->nextSlot = (e->nextSlot + 1) % EXP_DICT_SLOTS;
+		e->dictLen[e->slot] = e->len;
+	} else {
+		e->slot = op - OP_REF;
+		if (e->slot >= EXP_DICT_SLOTS || e->dictLen[e->slot] == 0) {
+			return false;
+		}
+		e->len = e->dictLen[e->slot];
+	}
+	return true;
+}
+
+int exp_expand(exp_state_t *e, uint8_t **in, uint16_t *inlen, uint8_t *out, uint16_t outlen) {
+	uint16_t n = 0;
+	while (n < outlen) {
+		if (e->done == e->len) {
+			// start the next op
+			if (*inlen == 0) {
+				break;
+			}
+			if (!beginOp(e, **in)) {
+				return -1;
+			}
+			(*in)++;
+			(*inlen)--;
+			continue;
+		}
+
+		// write as much of the current op as possible
+		uint16_t m = e->len - e->done;
+		if (m > outlen - n) {
+			m = outlen - n;
+		}
+		if (e->op < OP_ZEROS || (e->op >= OP_DEFINE && e->op < OP_REF)) {
+			if (m > *inlen) {
+				m = *inlen;
+			}
+			if (m == 0) {
+				break;
+			}
+			memmove(out + n, *in, m);
+			if (e->op >= OP_DEFINE) {
+				memmove(e->dict[e->slot] + e->done, *in, m);
+			}
+			*in += m;
+			*inlen -= m;
+		} else if (e->op < OP_DEFINE) {
+			memset(out + n, 0, m);
+		} else {
+			memmove(out + n, e->dict[e->slot] + e->done, m);
+		}
+		n += m;
+		e->done += m;
+	}
+	return n;
+}
@@ -16,6 +16,10 @@
 // Note that the order of the getPublicKey screens is the reverse of signHash:
 // first approval, then comparison.
 //
+// The computer may also request a whole range of keys at once (e.g. when
+// rescanning a wallet), in which case the user approves the range, and the
+// computer then fetches the keys without any further screens.
+//
 // Keep this description in mind as you read through the implementation.
 
 #include <os.h>
@@ -46,17 +50,14 @@ UX_DEF(
 );
 
 unsigned int io_seproxyhal_touch_pk_ok(void) {
-    cx_ecfp_public_key_t publicKey = {0};
-
     // The response APDU will contain multiple objects, which means we need to
     // remember our offset within G_io_apdu_buffer. By convention, the offset
     // variable is named 'tx'.
     uint8_t tx = 0;
 
-    deriveSiaKeypair(ctx->keyIndex, NULL, &publicKey);
-    extractPubkeyBytes(G_io_apdu_buffer + tx, &publicKey);
+    deriveSiaPublicKey(ctx->keyIndex, G_io_apdu_buffer + tx);
     tx += 32;
-    pubkeyToSiaAddress(G_io_apdu_buffer + tx, &publicKey);
+    pubkeyToSiaAddress(G_io_apdu_buffer + tx, G_io_apdu_buffer);
     tx += 76;
 
     // Flush the APDU buffer, sending the response.
@@ -80,6 +81,39 @@ unsigned int io_seproxyhal_touch_pk_ok(void) {
     return 0;
 }
 
+// packKeys derives as many of the remaining keys in the range as will fit in
+// a single response APDU, and packs them into G_io_apdu_buffer, returning the
+// number of bytes written. Each 32-byte public key is followed by its 32-byte
+// unlock hash, if requested. Deriving keys is slow, so packKeys is only
+// called from the command handler, one response per P1_NEXT, and never from
+// a button handler, which would block the UI until the range was done.
+static uint16_t packKeys(void) {
+    uint16_t tx = 0;
+    uint16_t size = ctx->genAddr ? 64 : 32;
+    while (ctx->sent < ctx->count && tx + size + 2 <= sizeof(G_io_apdu_buffer)) {
+        deriveSiaPublicKey(ctx->keyIndex + ctx->sent, G_io_apdu_buffer + tx);
+        if (ctx->genAddr) {
+            pubkeyToUnlockHash(G_io_apdu_buffer + tx + 32, G_io_apdu_buffer + tx);
+        }
+        tx += size;
+        ctx->sent++;
+    }
+    if (ctx->sent == ctx->count) {
+        ctx->approved = false;
+    }
+    return tx;
+}
+
+unsigned int io_seproxyhal_touch_pk_range_ok(void) {
+    // Just acknowledge the approval; the computer fetches the keys with
+    // P1_NEXT.
+    ctx->approved = true;
+    ctx->sent = 0;
+    io_exchange_with_code(SW_OK, 0);
+    ui_idle();
+    return 0;
+}
+
 UX_STEP_NOCB(
 	ux_approve_pk_flow_1_step, bn,
      {
@@ -115,19 +149,58 @@ UX_DEF(
 	&ux_approve_pk_flow_3_step
 );
 
+UX_STEP_VALID(
+	ux_approve_pk_range_flow_2_step,
+	pb,
+	io_seproxyhal_touch_pk_range_ok(),
+	{
+		&C_icon_validate,
+		"Approve"
+	}
+);
+
+UX_DEF(
+	ux_approve_pk_range_flow,
+	&ux_approve_pk_flow_1_step,
+	&ux_approve_pk_range_flow_2_step,
+	&ux_approve_pk_flow_3_step
+);
+
 // These are APDU parameters that control the behavior of the getPublicKey
 // command.
+#define P1_SINGLE 0x00 // generate a single key
+#define P1_RANGE  0x01 // generate a range of keys
+#define P1_NEXT   0x02 // fetch the next packet of keys in the range
 #define P2_DISPLAY_ADDRESS 0x00
 #define P2_DISPLAY_PUBKEY 0x01
 
+// PK_RANGE_MAX is the largest number of keys that may be requested with
+// P1_RANGE. It keeps the time the device spends on a single approval
+// bounded.
+#define PK_RANGE_MAX 1000
+
+// handleGetPublicKey generates a public key (and address) from a key index.
+//
+// With P1_RANGE, the payload instead contains a start index and a count,
+// both 4 bytes; the count may be at most PK_RANGE_MAX. The user approves the
+// range, and the empty response signals the approval. The computer then
+// fetches the keys with P1_NEXT, as many per response as fit. (With
+// P2_DISPLAY_ADDRESS, each public key is followed by its raw unlock hash,
+// rather than the hex address.)
 void handleGetPublicKey(uint8_t p1, uint8_t p2, uint8_t* buffer, uint16_t len,
                         /* out */ volatile unsigned int* flags,
                         /* out */ volatile unsigned int* tx) {
-    UNUSED(p1);
-    UNUSED(len);
-    UNUSED(tx);
+    if (p1 == P1_NEXT) {
+        // The user has already approved the range; derive and send the
+        // next batch.
+        if (!ctx->approved) {
+            THROW(SW_IMPROPER_INIT);
+        }
+        *tx = packKeys();
+        THROW(SW_OK);
+    }
 
-    if ((p2 != P2_DISPLAY_ADDRESS) && (p2 != P2_DISPLAY_PUBKEY)) {
+    if ((p1 != P1_SINGLE && p1 != P1_RANGE) || ((p2 != P2_DISPLAY_ADDRESS) && (p2 != P2_DISPLAY_PUBKEY))) {
         // Although THROW is technically a general-purpose exception
         // mechanism, within a command handler it is basically just a
         // convenient way of bailing out early and sending an error code to
@@ -141,6 +214,37 @@ void handleGetPublicKey(uint8_t p1, uint8_t p2, uint8_t* buffer, uint16_t len,
     // Read Key Index
     ctx->keyIndex = U4LE(buffer, 0);
     ctx->genAddr = (p2 == P2_DISPLAY_ADDRESS);
+    ctx->approved = false;
+
+    if (p1 == P1_RANGE) {
+        if (len < 8) {
+            THROW(SW_INVALID_PARAM);
+        }
+        ctx->count = U4LE(buffer, 4);
+        // the range must be nonempty and not too long, and must not wrap
+        // around
+        if (ctx->count == 0 || ctx->count > PK_RANGE_MAX || ctx->count - 1 > 0xFFFFFFFF - ctx->keyIndex) {
+            THROW(SW_INVALID_PARAM);
+        }
+        uint8_t *p = ctx->typeStr;
+        memmove(p, "Export ", 7);
+        p += 7;
+        p += bin2dec(p, ctx->count);
+        memmove(p, ctx->genAddr ? " Addresses" : " Public Keys", ctx->genAddr ? 11 : 13);
+        p = ctx->keyStr;
+        memmove(p, "from Key #", 10);
+        p += 10;
+        p += bin2dec(p, ctx->keyIndex);
+        memmove(p, " to #", 5);
+        p += 5;
+        p += bin2dec(p, ctx->keyIndex + ctx->count - 1);
+        memmove(p, "?", 2);
+
+        ui_idle();
+        ux_flow_init(0, ux_approve_pk_range_flow, NULL);
+        *flags |= IO_ASYNCH_REPLY;
+        return;
+    }
 
     if (ctx->genAddr) {
         memmove(ctx->typeStr, "Generate Address", 17);
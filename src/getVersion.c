@@ -7,12 +7,36 @@
 #include "sia_ux.h"
 #include <ux.h>
 
+#define P1_VERSION     0x00 // app version and max payload
+#define P1_CACHE_STATS 0x01 // public key cache counters
+
 // handleGetVersion is the entry point for the getVersion command. It
-// unconditionally sends the app version.
+// unconditionally sends the app version, followed by the largest payload
+// (big-endian) that an extended-length request APDU may carry, and the number
+// of dictionary slots available to compressed uploads (see expand.c).
+// Computers can use these to send transactions in as few exchanges as
+// possible.
+//
+// With P1_CACHE_STATS, it instead sends the number of hits and misses (each
+// 4 bytes, big-endian) of the public key cache (see deriveSiaPublicKey),
+// which is useful when deciding how large the cache should be.
 void handleGetVersion(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+	if (p1 == P1_CACHE_STATS) {
+		uint32_t hits, misses;
+		keyCacheStats(&hits, &misses);
+		for (int i = 0; i < 4; i++) {
+			G_io_apdu_buffer[i] = hits >> (24 - 8*i);
+			G_io_apdu_buffer[4+i] = misses >> (24 - 8*i);
+		}
+		io_exchange_with_code(SW_OK, 8);
+		return;
+	}
+	uint16_t maxPayload = sizeof(G_io_apdu_buffer) - 7; // extended APDU header
 	G_io_apdu_buffer[0] = APPVERSION[0] - '0';
 	G_io_apdu_buffer[1] = APPVERSION[2] - '0';
 	G_io_apdu_buffer[2] = APPVERSION[4] - '0';
-	io_exchange_with_code(SW_OK, 3);
+	G_io_apdu_buffer[3] = maxPayload >> 8;
+	G_io_apdu_buffer[4] = maxPayload & 0xFF;
+	G_io_apdu_buffer[5] = EXP_DICT_SLOTS;
+	io_exchange_with_code(SW_OK, 6);
 }
-
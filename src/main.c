@@ -111,6 +111,7 @@
 #include <ux.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 // You may notice that this file includes blake2b.h despite doing no hashing.
 // This is because the Sia app uses the Plan 9 convention for header files:
@@ -222,6 +223,7 @@ void io_exchange_with_code(uint16_t code, uint16_t tx) {
 }
 
 unsigned int io_seproxyhal_cancel(void) {
+    clearSigningKey();
     io_exchange_with_code(SW_USER_REJECTED, 0);
     // Return to the main screen.
     ui_idle();
@@ -269,6 +271,15 @@ static handler_fn_t* lookupHandler(uint8_t ins) {
 #define OFFSET_LC    0x04
 #define OFFSET_CDATA 0x05
 
+// An extended-length APDU can carry more than 255 bytes of payload. Its LC
+// byte is zero, and is followed by the actual length (big-endian), and then
+// the payload. The payload size is limited only by G_io_apdu_buffer, which is
+// enlarged in the Makefile on the Nano X. On the Nano S, it only has room for
+// short APDUs, so extended-length APDUs are not parsed at all.
+#define APDU_MAX_SHORT (OFFSET_CDATA + 255)
+#define OFFSET_EXT_LC    0x05
+#define OFFSET_EXT_CDATA 0x07
+
 // This is the main loop that reads and writes APDUs. It receives request
 // APDUs from the computer, looks up the corresponding command handler, and
 // calls it on the APDU payload. Then it loops around and calls io_exchange
@@ -283,6 +294,8 @@ static void sia_main(void) {
 	volatile unsigned int rx = 0;
 	volatile unsigned int tx = 0;
 	volatile unsigned int flags = 0;
+	// INS of the command that most recently used the global context.
+	volatile uint8_t ctxIns = 0;
 
 	// Exchange APDUs until EXCEPTION_IO_RESET is thrown.
 	for (;;) {
@@ -316,8 +329,40 @@ static void sia_main(void) {
 				if (!handlerFn) {
 					THROW(0x6D00);
 				}
+				// All commands share the global context, so when switching to
+				// a different command, clear the context. Otherwise, state
+				// left over from one command could be misinterpreted by
+				// another (e.g. as an approval to send more signatures).
+				// Any screen the previous command left up refers to the old
+				// context, so return to the main menu as well; otherwise,
+				// approving it would act on the cleared context.
+				if (G_io_apdu_buffer[OFFSET_INS] != ctxIns) {
+					memset(&global, 0, sizeof(global));
+					clearSigningKey();
+					ui_idle();
+					ctxIns = G_io_apdu_buffer[OFFSET_INS];
+				}
+				// Locate the payload. An LC of zero with data following it
+				// indicates an extended-length APDU.
+				uint8_t *cdata = G_io_apdu_buffer + OFFSET_CDATA;
+				uint16_t lc = G_io_apdu_buffer[OFFSET_LC];
+				if (lc == 0 && rx > OFFSET_CDATA) {
+#if IO_APDU_BUFFER_SIZE > APDU_MAX_SHORT
+					if (rx < OFFSET_EXT_CDATA) {
+						THROW(0x6700);
+					}
+					lc = U2BE(G_io_apdu_buffer, OFFSET_EXT_LC);
+					cdata = G_io_apdu_buffer + OFFSET_EXT_CDATA;
+#else
+					THROW(0x6700);
+#endif
+				}
+				// Wrong length.
+				if (cdata + lc > G_io_apdu_buffer + rx) {
+					THROW(0x6700);
+				}
 				handlerFn(G_io_apdu_buffer[OFFSET_P1], G_io_apdu_buffer[OFFSET_P2],
-				          G_io_apdu_buffer + OFFSET_CDATA, G_io_apdu_buffer[OFFSET_LC], &flags, &tx);
+				          cdata, lc, &flags, &tx);
 			}
 			CATCH(EXCEPTION_IO_RESET) {
 				THROW(EXCEPTION_IO_RESET);
@@ -26,6 +26,47 @@ void deriveSiaKeypair(uint32_t index, cx_ecfp_private_key_t *privateKey, cx_ecfp
 	memset(&pk, 0, sizeof(pk));
 }
 
+// Deriving a key takes hundreds of milliseconds, and computers tend to ask
+// for the same few public keys over and over, so the most recently derived
+// ones are cached. Entries are replaced round-robin. The Nano S, which is
+// shorter on RAM, caches fewer.
+#ifdef TARGET_NANOS
+#define KEY_CACHE_SIZE 4
+#else
+#define KEY_CACHE_SIZE 8
+#endif
+static uint32_t keyCacheIndices[KEY_CACHE_SIZE];
+static uint8_t keyCacheKeys[KEY_CACHE_SIZE][32];
+static uint8_t keyCacheLen;
+static uint8_t keyCacheNext;
+static uint32_t keyCacheHits, keyCacheMisses;
+
+void deriveSiaPublicKey(uint32_t index, uint8_t *dst) {
+	for (int i = 0; i < keyCacheLen; i++) {
+		if (keyCacheIndices[i] == index) {
+			memmove(dst, keyCacheKeys[i], 32);
+			keyCacheHits++;
+			return;
+		}
+	}
+	keyCacheMisses++;
+
+	cx_ecfp_public_key_t publicKey;
+	deriveSiaKeypair(index, NULL, &publicKey);
+	extractPubkeyBytes(dst, &publicKey);
+	keyCacheIndices[keyCacheNext] = index;
+	memmove(keyCacheKeys[keyCacheNext], dst, 32);
+	keyCacheNext = (keyCacheNext + 1) % KEY_CACHE_SIZE;
+	if (keyCacheLen < KEY_CACHE_SIZE) {
+		keyCacheLen++;
+	}
+}
+
+void keyCacheStats(uint32_t *hits, uint32_t *misses) {
+	*hits = keyCacheHits;
+	*misses = keyCacheMisses;
+}
+
 void extractPubkeyBytes(unsigned char *dst, cx_ecfp_public_key_t *publicKey) {
 	for (int i = 0; i < 32; i++) {
 		dst[i] = publicKey->W[64 - i];
@@ -35,7 +76,35 @@ void extractPubkeyBytes(unsigned char *dst, cx_ecfp_public_key_t *publicKey) {
 	}
 }
 
+// Deriving a private key takes a noticeable amount of time, so rather than
+// making the user wait after they approve a signature, the key can be derived
+// ahead of time, when the command that will need it begins. The key is held
+// in this slot until the signing flow ends, one way or another.
+static struct {
+	cx_ecfp_private_key_t key;
+	uint32_t index;
+	bool ready; // key holds the private key for index
+} signingKey;
+
+void prepareSigningKey(uint32_t index) {
+	if (signingKey.ready && signingKey.index == index) {
+		return;
+	}
+	clearSigningKey();
+	deriveSiaKeypair(index, &signingKey.key, NULL);
+	signingKey.index = index;
+	signingKey.ready = true;
+}
+
+void clearSigningKey(void) {
+	memset(&signingKey, 0, sizeof(signingKey));
+}
+
 void deriveAndSign(uint8_t *dst, uint32_t index, const uint8_t *hash) {
+	if (signingKey.ready && signingKey.index == index) {
+		cx_eddsa_sign(&signingKey.key, CX_RND_RFC6979 | CX_LAST, CX_SHA512, hash, 32, NULL, 0, dst, 64, NULL);
+		return;
+	}
 	cx_ecfp_private_key_t privateKey;
 	deriveSiaKeypair(index, &privateKey, NULL);
 	cx_eddsa_sign(&privateKey, CX_RND_RFC6979 | CX_LAST, CX_SHA512, hash, 32, NULL, 0, dst, 64, NULL);
@@ -51,7 +120,20 @@ void bin2hex(uint8_t *dst, uint8_t *data, uint64_t inlen) {
 	dst[2*inlen] = '\0';
 }
 
-void pubkeyToSiaAddress(uint8_t *dst, cx_ecfp_public_key_t *publicKey) {
+// The timelock and sigsrequired leaves of a standard address never change, so
+// their hashes are precomputed: they are the BLAKE2B hashes of a zero byte
+// (the RFC 6962 leaf prefix) followed by the 8-byte encodings of 0 and 1,
+// respectively.
+static const uint8_t noTimelockLeaf[32] = {
+	0x51, 0x87, 0xb7, 0xa8, 0x02, 0x1b, 0xf4, 0xf2, 0xc0, 0x04, 0xea, 0x3a, 0x54, 0xcf, 0xec, 0xe1,
+	0x75, 0x4f, 0x11, 0xc7, 0x62, 0x4d, 0x23, 0x63, 0xc7, 0xf4, 0xcf, 0x4f, 0xdd, 0xd1, 0x44, 0x1e,
+};
+static const uint8_t oneSigRequiredLeaf[32] = {
+	0xb3, 0x60, 0x10, 0xeb, 0x28, 0x5c, 0x15, 0x4a, 0x8c, 0xd6, 0x30, 0x84, 0xac, 0xbe, 0x7e, 0xac,
+	0x0c, 0x4d, 0x62, 0x5a, 0xb4, 0xe1, 0xa7, 0x6e, 0x62, 0x4a, 0x87, 0x98, 0xcb, 0x63, 0x49, 0x7b,
+};
+
+void pubkeyToSiaAddress(uint8_t *dst, const uint8_t *pubkey) {
 	// A Sia address is the Merkle root of a set of unlock conditions.
 	// For a "standard" address, the unlock conditions are:
 	//
@@ -59,52 +141,50 @@ void pubkeyToSiaAddress(uint8_t *dst, cx_ecfp_public_key_t *publicKey) {
 	// - one public key
 	// - one signature required
 	//
-	// For now, the Ledger will only be able to generate standard addresses.
-	// We can add support for arbitrary unlock conditions later.
+	// Thanks to the precomputed leaves, this costs just three BLAKE2B
+	// calls: one for the public key leaf, and two to join the nodes.
+	uint8_t unlockHash[32];
+	pubkeyToUnlockHash(unlockHash, pubkey);
+	unlockHashToSiaAddress(dst, unlockHash);
+}
 
+void pubkeyToUnlockHash(uint8_t *dst, const uint8_t *pubkey) {
 	// defined in RFC 6962
 	const uint8_t leafHashPrefix = 0;
 	const uint8_t nodeHashPrefix = 1;
 
-	// encode the timelock, pubkey, and sigsrequired
-	// TODO: can reuse buffers here to make this more efficient
-	uint8_t timelockData[9];
-	memset(timelockData, 0, sizeof(timelockData));
-	timelockData[0] = leafHashPrefix;
-
+	// encode the pubkey as a SiaPublicKey: a 16-byte algorithm specifier,
+	// followed by the length-prefixed key
 	uint8_t pubkeyData[57];
 	memset(pubkeyData, 0, sizeof(pubkeyData));
 	pubkeyData[0] = leafHashPrefix;
 	memmove(pubkeyData + 1, "ed25519", 7);
 	pubkeyData[17] = 32;
-	extractPubkeyBytes(pubkeyData + 25, publicKey);
-
-	uint8_t sigsrequiredData[9];
-	memset(sigsrequiredData, 0, sizeof(sigsrequiredData));
-	sigsrequiredData[0] = leafHashPrefix;
-	sigsrequiredData[1] = 1;
+	memmove(pubkeyData + 25, pubkey, 32);
 
 	// To calculate the Merkle root, we need a buffer large enough to hold two
 	// hashes plus a special leading byte.
 	uint8_t merkleData[65];
 	merkleData[0] = nodeHashPrefix;
-	// hash timelock into slot 1
-	blake2b(merkleData+1, 32, timelockData, sizeof(timelockData));
+	// copy the timelock leaf into slot 1
+	memmove(merkleData+1, noTimelockLeaf, 32);
 	// hash pubkey into slot 2
 	blake2b(merkleData+33, 32, pubkeyData, sizeof(pubkeyData));
 	// join hashes into slot 1
 	blake2b(merkleData+1, 32, merkleData, 65);
-	// hash sigsrequired into slot 2
-	blake2b(merkleData+33, 32, sigsrequiredData, sizeof(sigsrequiredData));
-	// join hashes into slot 1, finishing Merkle root (unlock hash)
-	blake2b(merkleData+1, 32, merkleData, 65);
+	// copy the sigsrequired leaf into slot 2
+	memmove(merkleData+33, oneSigRequiredLeaf, 32);
+	// join hashes into dst, finishing Merkle root (unlock hash)
+	blake2b(dst, 32, merkleData, 65);
+}
 
+void unlockHashToSiaAddress(uint8_t *dst, uint8_t *unlockHash) {
 	// hash the unlock hash to get a checksum
 	uint8_t checksum[6];
-	blake2b(checksum, sizeof(checksum), merkleData+1, 32);
+	blake2b(checksum, sizeof(checksum), unlockHash, 32);
 
 	// convert the hash+checksum to hex
-	bin2hex(dst, merkleData+1, 32);
+	bin2hex(dst, unlockHash, 32);
 	bin2hex(dst+64, checksum, sizeof(checksum));
 }
 
@@ -5,6 +5,7 @@
 #define SW_DEVELOPER_ERR 0x6B00
 #define SW_INVALID_PARAM 0x6B01
 #define SW_IMPROPER_INIT 0x6B02
+#define SW_BAD_OFFSET    0x6B03
 #define SW_USER_REJECTED 0x6985
 #define SW_OK            0x9000
 
@@ -34,32 +35,114 @@ typedef enum {
 	TXN_ELEM_TXN_SIG,
 } txnElemType_e;
 
+// cur_t is a fixed-width unsigned integer, large enough to hold the sum of all
+// the currency values in a transaction.
+#define CUR_WORDS 3
+typedef struct {
+	uint64_t w[CUR_WORDS]; // little-endian 64-bit words
+} cur_t;
+
+// cur_add adds a big-endian value of len bytes to sum. It returns false if
+// the value is too large or the sum overflows.
+bool cur_add(cur_t *sum, const uint8_t *val, uint8_t len);
+
+// cur_fmt converts a cur_t to a decimal string and appends a final NUL byte.
+// It returns the length of the string, which is at most 58. Zero is formatted
+// as the empty string (which formatSC turns into "0 SC").
+int cur_fmt(uint8_t *out, const cur_t *c);
+
+// txnMode_e indicates which parts of a transaction a decoder is sent.
+typedef enum {
+	TXN_MODE_WHOLE,       // the whole transaction
+	TXN_MODE_SIG_HEADERS, // the TxnSigs are abridged to the requested headers
+	TXN_MODE_PARTIAL,     // only the elements covered by a partial signature
+} txnMode_e;
+
+// TXN_MAX_SIGS is the maximum number of SigHashes that can be computed in a
+// single pass over a transaction.
+#define TXN_MAX_SIGS 8
+
+// txn_elem_t is a decoded element that is ready for display. It is kept in
+// raw form, and formatted only when displayed.
+typedef struct {
+	txnElemType_e type;
+	uint16_t index; // position within its slice, counting from 1
+	union {
+		// SC_OUTPUT, SF_OUTPUT, MINER_FEE
+		struct {
+			uint8_t val[18];  // currency value, big-endian
+			uint8_t valLen;   // length of val
+			uint8_t hash[32]; // unlock hash (outputs only)
+		} out;
+		// ARB_DATA
+		struct {
+			uint8_t preview[32]; // first bytes of the data
+			uint64_t len;        // full length of the data
+		} arb;
+	};
+} txn_elem_t;
+
 // txn_state_t is a helper object for computing the SigHash of a streamed
 // transaction.
 typedef struct {
-	uint8_t buf[510]; // holds raw tx bytes; large enough for two 0xFF reads
-	uint16_t buflen;  // number of valid bytes in buf
-	uint16_t pos;     // mid-decode offset; reset to 0 after each elem
+	uint8_t *in;          // unconsumed input from the most recent txn_update
+	uint16_t inlen;       // number of unconsumed bytes at in
+	uint8_t buf[81];      // holds a field that straddles two chunks; large enough for CoveredFields
+	uint16_t buflen;      // number of valid bytes in buf
+	uint32_t bytesCopied; // total bytes copied from in to buf
 
 	txnElemType_e elemType; // type of most-recently-seen element
 	uint64_t sliceLen;      // most-recently-seen slice length prefix
 	uint16_t sliceIndex;    // offset within current element slice
 
-	uint16_t sigIndex;   // index of TxnSig being computed
-	cx_blake2b_t blake;  // hash state
-	uint8_t sigHash[32]; // buffer to hold final hash
+	// decoder position within the current element, so that decoding can
+	// resume mid-element when more data arrives
+	uint8_t elemField;    // number of fields of the current element decoded
+	uint8_t ucField;      // next field of the current UnlockConditions (or slice of CoveredFields)
+	uint64_t numKeys;     // public keys (or CoveredFields indices) remaining
+	bool inPrefix;        // whether a length-prefixed field is being read
+	uint64_t prefixLen;   // bytes remaining in the current length-prefixed field
+	uint64_t prefixTotal; // total length of the current length-prefixed field
+
+	uint16_t sigIndices[TXN_MAX_SIGS]; // indices of TxnSigs being computed, in ascending order
+	uint8_t numSigs;                   // number of sigIndices
+	uint8_t sigsDone;                  // number of requested TxnSigs decoded so far
+	txnMode_e mode;                    // which parts of the transaction are present
+	cx_blake2b_t blake;                // hash state, shared by all SigHashes; never finalized
+
+	// Rather than storing each SigHash, we store the header of its
+	// TransactionSignature, and finish the hash on demand (see txn_sighash).
+	// Every requested TxnSig is stored, along with as many others as fit.
+	uint8_t sigHeaders[TXN_MAX_SIGS][48];
+	uint16_t sigHeaderIndices[TXN_MAX_SIGS]; // index of the TxnSig of each header
+	uint8_t numSigHeaders;                   // number of sigHeaders
+	bool finished;                           // whether the whole transaction has been decoded
 
-	uint8_t outVal[128]; // most-recently-seen currency value, in decimal
-	uint8_t valLen;      // length of outVal
-	uint8_t outAddr[77]; // most-recently-seen address
+	txn_elem_t elem; // most-recently-seen displayable element
+
+	cur_t scTotal;  // sum of all siacoin outputs decoded so far
+	cur_t sfTotal;  // sum of all siafund outputs decoded so far
+	cur_t feeTotal; // sum of all miner fees decoded so far
 } txn_state_t;
 
 // txn_init initializes a transaction decoder, preparing it to calculate the
-// requested SigHash.
-void txn_init(txn_state_t *txn, uint16_t sigIndex);
+// requested SigHashes. sigIndices must be in strictly ascending order, and
+// numSigs must be between 1 and TXN_MAX_SIGS.
+//
+// In TXN_MODE_SIG_HEADERS, the TransactionSignatures of the transaction are
+// expected to be abridged: the usual length prefix is followed only by the
+// 48-byte header (ParentID, PublicKeyIndex, and Timelock) of each requested
+// signature, in order.
+//
+// In TXN_MODE_PARTIAL, the decoder calculates the SigHash of a signature
+// whose CoveredFields do not set WholeTransaction. The transaction is
+// expected to contain only the covered elements, in the order they are
+// listed in the CoveredFields, and numSigs must be 1.
+void txn_init(txn_state_t *txn, const uint16_t *sigIndices, uint8_t numSigs, txnMode_e mode);
 
-// txn_update adds data to a transaction decoder.
-void txn_update(txn_state_t *txn, uint8_t *in, uint8_t inlen);
+// txn_update adds data to a transaction decoder. The data is not copied, so
+// it must remain valid until txn_next_elem returns TXN_STATE_PARTIAL.
+void txn_update(txn_state_t *txn, uint8_t *in, uint16_t inlen);
 
 // txn_next_elem decodes the next element of the transaction. If the element
 // is ready for display, txn_next_elem returns TXN_STATE_READY. If more data
@@ -68,6 +151,58 @@ void txn_update(txn_state_t *txn, uint8_t *in, uint8_t inlen);
 // decoded, it returns TXN_STATE_FINISHED.
 txnDecoderState_e txn_next_elem(txn_state_t *txn);
 
+// txn_sighash calculates the SigHash of a TransactionSignature of a
+// fully-decoded transaction, without decoding the transaction again. This is
+// possible for every requested signature, and for as many of the others as
+// fit in TXN_MAX_SIGS, in order. (In TXN_MODE_PARTIAL, it is possible only
+// for the requested signature.) It returns false if the transaction has not
+// been fully decoded, or if the signature's header was not kept.
+bool txn_sighash(txn_state_t *txn, uint16_t sigIndex, uint8_t *out);
+
+// exp_state_t holds the state of the expander for compressed transaction
+// uploads (see expand.c). The dictionary is most of it, so the Nano S, which
+// is shorter on RAM, gets half as many slots. (getVersion tells the computer
+// how many there are.)
+#ifdef TARGET_NANOS
+#define EXP_DICT_SLOTS 4
+#else
+#define EXP_DICT_SLOTS 8
+#endif
+typedef struct {
+	uint8_t dict[EXP_DICT_SLOTS][32]; // values stored by define ops
+	uint8_t dictLen[EXP_DICT_SLOTS];  // length of each value, or 0 if unset
+	uint8_t nextSlot;                 // slot that the next define op will use
+	uint8_t op;                       // current op
+	uint8_t len;                      // bytes of output produced by op
+	uint8_t done;                     // bytes of output produced by op so far
+	uint8_t slot;                     // dictionary slot of op, if any
+} exp_state_t;
+
+// exp_init initializes an expander.
+void exp_init(exp_state_t *e);
+
+// exp_expand expands compressed data from *in into out, advancing *in and
+// *inlen past whatever it consumes. It stops when out is full or *in is
+// exhausted, and returns the number of bytes written to out, or -1 if the
+// data is invalid.
+int exp_expand(exp_state_t *e, uint8_t **in, uint16_t *inlen, uint8_t *out, uint16_t outlen);
+
+// A continuation token is a nonce, followed by encrypted state, followed by
+// an authentication tag.
+#define TOKEN_NONCE_LEN 12
+#define TOKEN_TAG_LEN   32
+
+// token_nonce generates a random nonce for a new continuation token.
+void token_nonce(uint8_t *nonce);
+
+// token_crypt encrypts or decrypts len bytes of token state in place, where
+// pos is the offset of buf within the state.
+void token_crypt(const uint8_t *nonce, uint32_t pos, uint8_t *buf, uint16_t len);
+
+// token_mac calculates the authentication tag of a token whose (unencrypted)
+// state is the concatenation of a and b.
+void token_mac(uint8_t *tag, const uint8_t *nonce, const uint8_t *a, uint16_t alen, const uint8_t *b, uint16_t blen);
+
 // bin2hex converts binary to hex and appends a final NUL byte.
 void bin2hex(uint8_t *dst, uint8_t *data, uint64_t inlen);
 
@@ -83,14 +218,45 @@ int formatSC(uint8_t *buf, uint8_t decLen);
 // 32-byte array.
 void extractPubkeyBytes(unsigned char *dst, cx_ecfp_public_key_t *publicKey);
 
-// pubkeyToSiaAddress converts a Ledger pubkey to a Sia wallet address.
-void pubkeyToSiaAddress(uint8_t *dst, cx_ecfp_public_key_t *publicKey);
+// pubkeyToSiaAddress converts a 32-byte pubkey to a Sia wallet address.
+void pubkeyToSiaAddress(uint8_t *dst, const uint8_t *pubkey);
+
+// pubkeyToUnlockHash calculates the 32-byte unlock hash of the standard
+// address of a 32-byte pubkey.
+void pubkeyToUnlockHash(uint8_t *dst, const uint8_t *pubkey);
+
+// unlockHashToSiaAddress converts a 32-byte unlock hash to a Sia wallet
+// address by appending its checksum and hex-encoding the result. dst must
+// hold at least 77 bytes.
+void unlockHashToSiaAddress(uint8_t *dst, uint8_t *unlockHash);
 
 // deriveSiaKeypair derives an Ed25519 key pair from an index and the Ledger
 // seed. Either privateKey or publicKey may be NULL.
 void deriveSiaKeypair(uint32_t index, cx_ecfp_private_key_t *privateKey, cx_ecfp_public_key_t *publicKey);
 
+// deriveSiaPublicKey derives a 32-byte Ed25519 public key from an index and
+// the Ledger seed, consulting a small cache of recently derived keys first.
+void deriveSiaPublicKey(uint32_t index, uint8_t *dst);
+
+// keyCacheStats reports how many times deriveSiaPublicKey has found a key in
+// its cache, and how many times it has had to derive one, since the app
+// started.
+void keyCacheStats(uint32_t *hits, uint32_t *misses);
+
 // deriveAndSign derives an Ed25519 private key from an index and the
 // Ledger seed, and uses it to produce a 64-byte signature of the provided
-// 32-byte hash. The key is cleared from memory after signing.
+// 32-byte hash. The key is cleared from memory after signing, unless it was
+// derived ahead of time by prepareSigningKey, in which case it is used as-is
+// and left in place for further signatures.
 void deriveAndSign(uint8_t *dst, uint32_t index, const uint8_t *hash);
+
+// prepareSigningKey derives the private key for index ahead of time, so that
+// deriveAndSign need not derive it once the user approves. It replaces any
+// other key held, and does nothing if the key is already held. It should be
+// called from a command handler, so that any exception raised by the
+// derivation is reported to the computer.
+void prepareSigningKey(uint32_t index);
+
+// clearSigningKey erases the key derived by prepareSigningKey. It should be
+// called as soon as the signing flow that requested the key is over.
+void clearSigningKey(void);
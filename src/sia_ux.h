@@ -7,25 +7,82 @@
 typedef struct {
 	uint32_t keyIndex;
 	bool genAddr;
+	// For a range of keys (see P1_RANGE), keyIndex is the first index.
+	uint32_t count;  // number of keys in the range
+	uint32_t sent;   // number of keys sent so far
+	bool approved;   // user approved the range; keys remain to be sent
 	// NUL-terminated strings for display
 	uint8_t typeStr[40]; // variable-length
 	uint8_t keyStr[40]; // variable-length
 	uint8_t fullStr[77]; // variable length
 } getPublicKeyContext_t;
 
+// SIGN_HASH_BATCH_MAX is the number of (key index, hash) pairs that can be
+// signed with a single approval. It is chosen so that signHashContext_t is no
+// larger than calcTxnHashContext_t.
+#define SIGN_HASH_BATCH_MAX 40
+
 typedef struct {
 	uint32_t keyIndex;
-	uint8_t hash[32];
-	uint8_t hexHash[64];
+	uint8_t hash[32];    // for a batch, the digest of the list of pairs
+	uint8_t hexHash[65];
+	// A batch of pairs (see P1_BATCH_FIRST), each stored as it was sent: a
+	// 4-byte little-endian key index followed by the hash.
+	uint8_t pairs[SIGN_HASH_BATCH_MAX][36];
+	uint8_t numPairs;
+	uint8_t sent;         // number of signatures sent so far
+	bool reviewing;       // batch is displayed for approval
+	bool approved;        // user approved the batch; signatures remain to be sent
+	uint8_t countStr[12]; // NUL-terminated string for display, e.g. "40 Hashes"
 } signHashContext_t;
 
+// TXN_ELEM_QUEUE_LEN is the number of decoded elements that can be held
+// while the user reviews them. The Nano S, which is shorter on RAM, holds
+// fewer, and so asks for the next packet a little later.
+#ifdef TARGET_NANOS
+#define TXN_ELEM_QUEUE_LEN 2
+#else
+#define TXN_ELEM_QUEUE_LEN 4
+#endif
+
 typedef struct {
-	uint32_t keyIndex;
+	// The fields up to (but not including) approved, along with txn, are
+	// the transaction's progress, which is saved in continuation tokens (see
+	// P1_EXPORT).
+	uint32_t keyIndices[TXN_MAX_SIGS]; // one per requested SigHash
 	bool sign;
+	bool summary;     // display totals instead of individual elements
+	bool hashOnly;    // display nothing but the final SigHash
+	bool resumable;   // packets are prefixed with their offset
+	bool compressed;  // packets are compressed; see expand.c
+	uint32_t offset;  // bytes of transaction data received so far
+	exp_state_t exp;
+	bool approved;    // user approved signing; signatures remain to be sent
+	bool reviewed;    // user approved signing the last transaction; see P1_REUSE
 	uint8_t elemPart; // screen index of elements
+	uint8_t sigPart;  // index of the SigHash being displayed or signed
 	txn_state_t txn;
-	// NUL-terminated strings for display
-	uint8_t labelStr[40]; // variable length
+	// Displayable elements are queued as they are decoded, so that decoding
+	// (and hashing) can continue while the user reviews them. The element at
+	// queueHead is the one being displayed.
+	txn_elem_t queue[TXN_ELEM_QUEUE_LEN];
+	uint8_t queueHead;
+	uint8_t queueLen;
+	bool showing;      // the element at queueHead is on screen
+	bool replyPending; // the most recent packet has not been acknowledged
+	// If the transaction is compressed, the packet is expanded into xbuf a
+	// piece at a time; zin and zinlen track the rest of the packet.
+	uint8_t *zin;
+	uint16_t zinlen;
+	uint8_t xbuf[64];
+	// A continuation token being exported or imported.
+	uint8_t tokenNonce[TOKEN_NONCE_LEN];
+	uint8_t tokenTag[TOKEN_TAG_LEN];
+	uint16_t tokenPos;  // bytes of the token imported so far
+	bool importing;     // a token is being imported; ctx is not yet valid
+	// NUL-terminated strings for display. Elements are kept in raw form
+	// until they are displayed, and then formatted into fullStr.
+	uint8_t labelStr[24]; // variable length
 	uint8_t fullStr[128]; // variable length
 	bool initialized; // protects against certain attacks
 } calcTxnHashContext_t;
@@ -39,6 +96,9 @@ typedef union {
 } commandContext;
 extern commandContext global;
 
+// Batches must not grow the union; see SIGN_HASH_BATCH_MAX.
+_Static_assert(sizeof(signHashContext_t) <= sizeof(calcTxnHashContext_t), "signHashContext_t is larger than calcTxnHashContext_t; lower SIGN_HASH_BATCH_MAX");
+
 // These are helper macros for defining UI elements. There are four basic UI
 // elements: the background, which is a black rectangle that fills the whole
 // screen; icons on the left and right sides of the screen, typically used for
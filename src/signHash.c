@@ -35,6 +35,7 @@ static unsigned int io_seproxyhal_touch_hash_ok(void) {
     // the APDU buffer. This is the first Sia-specific function we've
     // encountered; it is defined in sia.c.
     deriveAndSign(G_io_apdu_buffer, ctx->keyIndex, ctx->hash);
+    clearSigningKey();
     io_exchange_with_code(SW_OK, 64);
 
     ui_idle();
@@ -77,9 +78,164 @@ UX_DEF(
 	&ux_approve_hash_flow_3_step
 );
 
+// sendBatchSigs signs as many of the remaining hashes in the batch as will fit
+// in a single response APDU, and sends them to the computer. If any hashes
+// remain, the computer can request them with P1_BATCH_NEXT.
+static void sendBatchSigs(void) {
+    uint16_t tx = 0;
+    while (ctx->sent < ctx->numPairs && tx + 64 + 2 <= sizeof(G_io_apdu_buffer)) {
+        const uint8_t *pair = ctx->pairs[ctx->sent];
+        // Batches tend to reuse the same few keys, so keep the last key
+        // around rather than deriving it again for each hash.
+        prepareSigningKey(U4LE(pair, 0));
+        deriveAndSign(G_io_apdu_buffer + tx, U4LE(pair, 0), pair + 4);
+        tx += 64;
+        ctx->sent++;
+    }
+    if (ctx->sent == ctx->numPairs) {
+        ctx->approved = false;
+        clearSigningKey();
+    }
+    io_exchange_with_code(SW_OK, tx);
+}
+
+static unsigned int io_seproxyhal_touch_batch_ok(void) {
+    // The batch can't have changed since it was displayed, or the digest
+    // the user approved would be stale.
+    if (!ctx->reviewing) {
+        io_exchange_with_code(SW_IMPROPER_INIT, 0);
+        ui_idle();
+        return 0;
+    }
+    ctx->reviewing = false;
+    ctx->approved = true;
+    ctx->sent = 0;
+    sendBatchSigs();
+    ui_idle();
+    return 0;
+}
+
+UX_STEP_NOCB(
+	ux_approve_batch_flow_1_step,
+	bn,
+	{
+		"Sign Batch of",
+		global.signHashContext.countStr
+	}
+);
+
+UX_STEP_NOCB(
+	ux_approve_batch_flow_2_step,
+	bnnn_paging,
+	{
+		"Compare Digest:",
+		global.signHashContext.hexHash
+	}
+);
+
+UX_STEP_VALID(
+	ux_approve_batch_flow_3_step,
+	pb,
+	io_seproxyhal_touch_batch_ok(),
+	{
+		&C_icon_validate,
+		"Approve"
+	}
+);
+
+UX_DEF(
+	ux_approve_batch_flow,
+	&ux_approve_batch_flow_1_step,
+	&ux_approve_batch_flow_2_step,
+	&ux_approve_batch_flow_3_step,
+	&ux_approve_hash_flow_3_step
+);
+
+// These are APDU parameters that control the behavior of the signHash
+// command.
+#define P1_SINGLE      0x00 // sign a single hash
+#define P1_BATCH_FIRST 0x01 // begin a new batch of hashes
+#define P1_BATCH_MORE  0x02 // add more hashes to the batch
+#define P1_BATCH_SIGN  0x03 // display the batch for approval
+#define P1_BATCH_NEXT  0x04 // fetch the next packet of signatures
+
+// handleSignHash reads a key index and a 32-byte hash, and signs the hash
+// once the user has compared it and approved.
+//
+// Hashes can also be signed in batches, with a single approval. P1_BATCH_FIRST
+// and P1_BATCH_MORE packets each carry one or more (key index, hash) pairs,
+// 36 bytes apiece, up to SIGN_HASH_BATCH_MAX pairs in total. P1_BATCH_SIGN
+// then shows the user the number of pairs and the BLAKE2b-256 digest of the
+// pairs as sent, which they compare against the digest shown on the
+// computer. Once they approve, the signatures are sent in order, as many per
+// response as fit; the computer fetches the rest with P1_BATCH_NEXT.
 void handleSignHash(uint8_t p1, uint8_t p2, uint8_t *buffer, uint16_t len,
                     /* out */ volatile unsigned int *flags,
                     /* out */ volatile unsigned int *tx) {
+    if (p1 == P1_BATCH_NEXT) {
+        // The user has already approved the batch; send the next packet.
+        if (!ctx->approved) {
+            THROW(SW_IMPROPER_INIT);
+        }
+        sendBatchSigs();
+        return;
+    }
+
+    if (p1 == P1_BATCH_FIRST || p1 == P1_BATCH_MORE) {
+        if (p1 == P1_BATCH_FIRST) {
+            ctx->numPairs = 0;
+        }
+        // Adding to the batch invalidates any approval of it, and any
+        // digest the user may be looking at.
+        ctx->approved = false;
+        if (ctx->reviewing) {
+            ctx->reviewing = false;
+            ui_idle();
+        }
+        if (len == 0 || len % 36 != 0 || len / 36 > SIGN_HASH_BATCH_MAX - ctx->numPairs) {
+            ctx->numPairs = 0;
+            THROW(SW_INVALID_PARAM);
+        }
+        memmove(ctx->pairs[ctx->numPairs], buffer, len);
+        ctx->numPairs += len / 36;
+        THROW(SW_OK);
+    }
+
+    if (p1 == P1_BATCH_SIGN) {
+        if (ctx->numPairs == 0) {
+            THROW(SW_IMPROPER_INIT);
+        }
+        ctx->approved = false;
+        cx_blake2b_t S;
+        blake2b_init(&S);
+        blake2b_update(&S, ctx->pairs[0], ctx->numPairs * 36);
+        blake2b_final(&S, ctx->hash, sizeof(ctx->hash));
+        bin2hex(ctx->hexHash, ctx->hash, sizeof(ctx->hash));
+        uint8_t *p = ctx->countStr + bin2dec(ctx->countStr, ctx->numPairs);
+        if (ctx->numPairs == 1) {
+            memmove(p, " Hash", 6);
+        } else {
+            memmove(p, " Hashes", 8);
+        }
+
+        // Derive the first signing key now, rather than after the user
+        // approves. (This precedes ux_flow_init, so that if it throws, no
+        // screen is left waiting for approval.)
+        prepareSigningKey(U4LE(ctx->pairs[0], 0));
+        ctx->reviewing = true;
+        ux_flow_init(0, ux_approve_batch_flow, NULL);
+        *flags |= IO_ASYNCH_REPLY;
+        return;
+    }
+
+    if (p1 != P1_SINGLE) {
+        THROW(SW_INVALID_PARAM);
+    }
+    // A single hash replaces any batch in progress.
+    ctx->numPairs = 0;
+    ctx->reviewing = false;
+    ctx->approved = false;
+
     // Read the index of the signing key. U4LE is a helper macro for
     // converting a 4-byte buffer to a uint32_t.
     ctx->keyIndex = U4LE(buffer, 0);
@@ -89,6 +245,11 @@ void handleSignHash(uint8_t p1, uint8_t p2, uint8_t *buffer, uint16_t len,
     // Prepare to display the comparison screen by converting the hash to hex
     bin2hex(ctx->hexHash, ctx->hash, sizeof(ctx->hash));
 
+    // Derive the signing key now, so that approving the hash doesn't mean
+    // waiting for the derivation. (This precedes ux_flow_init, so that if it
+    // throws, no screen is left waiting for approval.)
+    prepareSigningKey(ctx->keyIndex);
+
     ux_flow_init(0, ux_approve_hash_flow, NULL);
 
     *flags |= IO_ASYNCH_REPLY;
@@ -0,0 +1,69 @@
+// This file contains the cryptography behind continuation tokens, which
+// allow the computer to hold onto the state of a partially-decoded
+// transaction on the device's behalf (see P1_EXPORT in calcTxnHash.c).
+//
+// A token is encrypted with AES-CTR and authenticated with HMAC-SHA256. The
+// keys are generated randomly the first time they are needed, and are never
+// stored, so tokens are only valid until the app exits. That's fine: a token
+// is only useful for picking up where a transaction left off, and the
+// decoder state it contains (e.g. the BLAKE2b midstate) shouldn't outlive the
+// session anyway.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <os.h>
+#include <cx.h>
+#include "blake2b.h"
+#include "sia.h"
+
+// tokenKeys holds the AES key, followed by the HMAC key.
+static uint8_t tokenKeys[16 + 32];
+static bool tokenKeysReady;
+
+static void initTokenKeys(void) {
+	if (!tokenKeysReady) {
+		cx_rng(tokenKeys, sizeof(tokenKeys));
+		tokenKeysReady = true;
+	}
+}
+
+void token_nonce(uint8_t *nonce) {
+	initTokenKeys();
+	cx_rng(nonce, TOKEN_NONCE_LEN);
+}
+
+void token_crypt(const uint8_t *nonce, uint32_t pos, uint8_t *buf, uint16_t len) {
+	initTokenKeys();
+	cx_aes_key_t key;
+	cx_aes_init_key(tokenKeys, 16, &key);
+
+	// Each 16-byte block of keystream is the encryption of the nonce,
+	// followed by the block's index. Since any block can be generated
+	// independently, the token can be encrypted and decrypted piecemeal.
+	uint8_t ctr[16], stream[16];
+	memmove(ctr, nonce, TOKEN_NONCE_LEN);
+	while (len > 0) {
+		uint32_t block = pos / 16;
+		ctr[12] = block >> 24;
+		ctr[13] = block >> 16;
+		ctr[14] = block >> 8;
+		ctr[15] = block;
+		cx_aes(&key, CX_ENCRYPT | CX_CHAIN_ECB | CX_PAD_NONE | CX_LAST, ctr, 16, stream, 16);
+		for (uint8_t i = pos % 16; i < 16 && len > 0; i++) {
+			*buf++ ^= stream[i];
+			pos++;
+			len--;
+		}
+	}
+	memset(&key, 0, sizeof(key));
+}
+
+void token_mac(uint8_t *tag, const uint8_t *nonce, const uint8_t *a, uint16_t alen, const uint8_t *b, uint16_t blen) {
+	initTokenKeys();
+	cx_hmac_sha256_t hmac;
+	cx_hmac_sha256_init(&hmac, tokenKeys + 16, 32);
+	cx_hmac((cx_hmac_t *)&hmac, 0, nonce, TOKEN_NONCE_LEN, NULL, 0);
+	cx_hmac((cx_hmac_t *)&hmac, 0, a, alen, NULL, 0);
+	cx_hmac((cx_hmac_t *)&hmac, CX_LAST, b, blen, tag, TOKEN_TAG_LEN);
+}
@@ -5,183 +5,264 @@
 #include "blake2b.h"
 #include "sia.h"
 
-static void divWW10(uint64_t u1, uint64_t u0, uint64_t *q, uint64_t *r) {
-	const uint64_t s = 60ULL;
-	const uint64_t v = 11529215046068469760ULL;
-	const uint64_t vn1 = 2684354560ULL;
-	const uint64_t _B2 = 4294967296ULL;
-	uint64_t un32 = u1<<s | u0>>(64-s);
-	uint64_t un10 = u0 << s;
-	uint64_t un1 = un10 >> 32;
-	uint64_t un0 = un10 & (_B2-1);
-	uint64_t q1 = un32 / vn1;
-	uint64_t rhat = un32 - q1*vn1;
-
-	while (q1 >= _B2) {
-		q1--;
-		rhat += vn1;
-		if (rhat >= _B2) {
-			break;
-		}
+// The decoder reads fields directly out of the most recent chunk passed to
+// txn_update (typically G_io_apdu_buffer), without copying it. Only when a
+// field straddles two chunks is the unfinished tail copied into txn->buf,
+// where it waits for the remainder of the field to arrive.
+//
+// Decoding functions return TXN_OK once they have finished decoding, or
+// otherwise the txnDecoderState_e that txn_next_elem should return, e.g.
+// TXN_STATE_PARTIAL if the field is incomplete. CHECK passes any such state
+// straight up to the caller.
+#define TXN_OK 0
+#define CHECK(x) do { txnDecoderState_e _s = (x); if (_s != TXN_OK) return _s; } while (0)
+
+// need_at_least sets field to point to the next n bytes of the transaction,
+// which are guaranteed to be contiguous. If fewer than n bytes are
+// available, it returns TXN_STATE_PARTIAL.
+static txnDecoderState_e need_at_least(txn_state_t *txn, uint64_t n, uint8_t **field) {
+	if (txn->buflen == 0 && txn->inlen >= n) {
+		*field = txn->in;
+		return TXN_OK;
 	}
-
-	uint64_t un21 = un32*_B2 + un1 - q1*v;
-	uint64_t q0 = un21 / vn1;
-	rhat = un21 - q0*vn1;
-
-	while (q0 >= _B2) {
-		q0--;
-		rhat += vn1;
-		if (rhat >= _B2) {
-			break;
+	if (n > sizeof(txn->buf)) {
+		return TXN_STATE_ERR;
+	}
+	if (txn->buflen < n) {
+		// move as much of the field as possible into buf
+		uint16_t m = n - txn->buflen;
+		if (m > txn->inlen) {
+			m = txn->inlen;
+		}
+		memmove(txn->buf + txn->buflen, txn->in, m);
+		txn->buflen += m;
+		txn->in += m;
+		txn->inlen -= m;
+		txn->bytesCopied += m;
+		if (txn->buflen < n) {
+			return TXN_STATE_PARTIAL;
 		}
 	}
+	*field = txn->buf;
+	return TXN_OK;
+}
 
-	*q = q1*_B2 + q0;
-	*r = (un21*_B2 + un0 - q0*v) >> s;
+// available returns the number of contiguous bytes that can be read without
+// copying.
+static uint16_t available(txn_state_t *txn) {
+	return txn->buflen ? txn->buflen : txn->inlen;
 }
 
-static uint64_t quorem10(uint64_t nat[], int len) {
-	uint64_t r = 0;
-	for (int i = len - 1; i >= 0; i--) {
-		divWW10(r, nat[i], &nat[i], &r);
+// drain removes n bytes from the front of the transaction.
+static void drain(txn_state_t *txn, uint16_t n) {
+	if (txn->buflen) {
+		txn->buflen -= n;
+		memmove(txn->buf, txn->buf + n, txn->buflen);
+	} else {
+		txn->in += n;
+		txn->inlen -= n;
 	}
-	return r;
 }
 
-// cur2dec converts a Sia-encoded currency value to a decimal string and
-// appends a final NUL byte. It returns the length of the string. If the value
-// is too large, it throws TXN_STATE_ERR.
-static int cur2dec(uint8_t *out, uint8_t *cur) {
-	if (cur[0] == 0) {
-		out[0] = '\0';
-		return 0;
+// consume drains a fully-decoded field of n bytes, first adding it to the
+// hash if it is covered by the SigHash. TransactionSignatures are only
+// covered by partial signatures; see readSigHeader.
+static void consume(txn_state_t *txn, uint8_t *field, uint16_t n) {
+	if (txn->elemType != TXN_ELEM_TXN_SIG || txn->mode == TXN_MODE_PARTIAL) {
+		blake2b_update(&txn->blake, field, n);
 	}
+	drain(txn, n);
+}
 
-	// sanity check the size of the value. The size (in bytes) is given in the
-	// first byte; it should never be greater than 18 (18 bytes = 144 bits,
-	// i.e. a value of 2^144 H, or 22 quadrillion SC).
-	if (cur[0] > 18) {
-		THROW(TXN_STATE_ERR);
+// readInt decodes a uint64 into u, which may be NULL.
+static txnDecoderState_e readInt(txn_state_t *txn, uint64_t *u) {
+	uint8_t *field;
+	CHECK(need_at_least(txn, 8, &field));
+	if (u) {
+		*u = U8LE(field, 0);
 	}
+	consume(txn, field, 8);
+	return TXN_OK;
+}
 
-
-	// convert big-endian uint8_t[] to little-endian uint64_t[]
-	//
-	// NOTE: the Sia encoding omits any leading zeros, so the first "uint64"
-	// may not be a full 8 bytes. We handle this by treating the length prefix
-	// as part of the first uint64. This is safe as long as the length prefix
-	// has only 1 non-zero byte, which should be enforced elsewhere.
-	uint64_t nat[32];
-	int len = (cur[0] / 8) + ((cur[0] % 8) != 0);
-	cur += 8 - (len*8 - cur[0]);
-	for (int i = 0; i < len; i++) {
-		nat[len-i-1] = U8BE(cur, i*8);
+// readCurrency decodes a currency value into txn->elem for display, and adds
+// it to total. It is treated as a single field, so that the value is
+// contiguous. Currency values that are not displayed are decoded with
+// readPrefixedBytes instead.
+static txnDecoderState_e readCurrency(txn_state_t *txn, cur_t *total) {
+	uint8_t *field;
+	CHECK(need_at_least(txn, 8, &field));
+	// sanity check the size of the value; it should never be greater than 18
+	// bytes (18 bytes = 144 bits, i.e. a value of 2^144 H, or 22 quadrillion
+	// SC).
+	uint64_t valLen = U8LE(field, 0);
+	if (valLen > 18) {
+		return TXN_STATE_ERR;
 	}
-
-	// decode digits into buf, right-to-left
-	//
-	// NOTE: buf must be large enough to hold the decimal representation of
-	// 2^144, which has 44 digits.
-	uint8_t buf[64];
-	int i = sizeof(buf);
-	buf[--i] = '\0';
-	while (len > 0) {
-		if (i <= 0) {
-			THROW(TXN_STATE_ERR);
-		}
-		buf[--i] = '0' + quorem10(nat, len);
-		// normalize nat
-		while (len > 0 && nat[len-1] == 0) {
-			len--;
-		}
+	CHECK(need_at_least(txn, 8+valLen, &field));
+	memmove(txn->elem.out.val, field+8, valLen);
+	txn->elem.out.valLen = valLen;
+	if (!cur_add(total, field+8, valLen)) {
+		return TXN_STATE_ERR;
 	}
-
-	// copy buf->out, trimming whitespace
-	memmove(out, buf+i, sizeof(buf)-i);
-	return sizeof(buf)-i-1;
+	consume(txn, field, 8+valLen);
+	return TXN_OK;
 }
 
-static void need_at_least(txn_state_t *txn, uint64_t n) {
-	if ((txn->buflen - txn->pos) < n) {
-		THROW(TXN_STATE_PARTIAL);
+// readHash decodes a 32-byte hash. If out is non-NULL, the raw hash is copied
+// into it; converting it to an address is left until it is actually
+// displayed (see fmtTxnElem).
+static txnDecoderState_e readHash(txn_state_t *txn, uint8_t *out) {
+	uint8_t *field;
+	CHECK(need_at_least(txn, 32, &field));
+	if (out) {
+		memmove(out, field, 32);
 	}
+	consume(txn, field, 32);
+	return TXN_OK;
 }
 
-static void seek(txn_state_t *txn, uint64_t n) {
-	need_at_least(txn, n);
-	txn->pos += n;
-}
-
-static void advance(txn_state_t *txn) {
-	// if elem is covered, add it to the hash
-	if (txn->elemType != TXN_ELEM_TXN_SIG) {
-		blake2b_update(&txn->blake, txn->buf, txn->pos);
-	} else if (txn->sliceIndex == txn->sigIndex && txn->pos >= 48) {
-		// add just the ParentID, Timelock, and PublicKeyIndex
-		blake2b_update(&txn->blake, txn->buf, 48);
+// readPrefixedBytes consumes a length-prefixed field as bytes arrive,
+// tracking the number of bytes remaining in txn->prefixLen. Since the bytes
+// are hashed incrementally and never buffered, the field (and thus the
+// element containing it) may be arbitrarily large; only fixed-size fields
+// ever need to fit in txn->buf. If out is non-NULL, the first outlen bytes
+// of the field are copied into it.
+static txnDecoderState_e readPrefixedBytes(txn_state_t *txn, uint8_t *out, uint16_t outlen) {
+	if (!txn->inPrefix) {
+		CHECK(readInt(txn, &txn->prefixTotal));
+		txn->prefixLen = txn->prefixTotal;
+		txn->inPrefix = true;
 	}
-
-	txn->buflen -= txn->pos;
-	memmove(txn->buf, txn->buf+txn->pos, txn->buflen);
-	txn->pos = 0;
-}
-
-static uint64_t readInt(txn_state_t *txn) {
-	need_at_least(txn, 8);
-	uint64_t u = U8LE(txn->buf, txn->pos);
-	seek(txn, 8);
-	return u;
-}
-
-static void readCurrency(txn_state_t *txn, uint8_t *outVal) {
-	uint64_t valLen = readInt(txn);
-	need_at_least(txn, valLen);
-	if (outVal) {
-		txn->valLen = cur2dec(outVal, txn->buf+txn->pos-8);
+	while (txn->prefixLen > 0) {
+		uint8_t *field;
+		CHECK(need_at_least(txn, 1, &field));
+		uint16_t n = available(txn);
+		if (n > txn->prefixLen) {
+			n = txn->prefixLen;
+		}
+		uint64_t off = txn->prefixTotal - txn->prefixLen;
+		if (out && off < outlen) {
+			memmove(out + off, field, (outlen - off < n) ? outlen - off : n);
+		}
+		consume(txn, field, n);
+		txn->prefixLen -= n;
 	}
-	seek(txn, valLen);
+	txn->inPrefix = false;
+	return TXN_OK;
 }
 
-static void readHash(txn_state_t *txn, uint8_t *outAddr) {
-	need_at_least(txn, 32);
-	if (outAddr) {
-		bin2hex(outAddr, txn->buf+txn->pos, 32);
-		uint8_t checksum[6];
-		blake2b(checksum, sizeof(checksum), txn->buf+txn->pos, 32);
-		bin2hex(outAddr+64, checksum, sizeof(checksum));
+// UnlockConditions fields, in the order they are decoded. The Algorithm and
+// Key fields repeat once per public key.
+enum {
+	UC_TIMELOCK,
+	UC_NUM_KEYS,
+	UC_ALGORITHM,
+	UC_KEY,
+	UC_SIGS_REQUIRED,
+};
+
+static txnDecoderState_e readUnlockConditions(txn_state_t *txn) {
+	uint8_t *field;
+	for (;;) {
+		switch (txn->ucField) {
+		case UC_TIMELOCK:
+			CHECK(readInt(txn, NULL));
+			txn->ucField = UC_NUM_KEYS;
+			break;
+		case UC_NUM_KEYS:
+			CHECK(readInt(txn, &txn->numKeys));
+			txn->ucField = txn->numKeys ? UC_ALGORITHM : UC_SIGS_REQUIRED;
+			break;
+		case UC_ALGORITHM:
+			CHECK(need_at_least(txn, 16, &field));
+			consume(txn, field, 16);
+			txn->ucField = UC_KEY;
+			break;
+		case UC_KEY:
+			CHECK(readPrefixedBytes(txn, NULL, 0));
+			txn->numKeys--;
+			txn->ucField = txn->numKeys ? UC_ALGORITHM : UC_SIGS_REQUIRED;
+			break;
+		case UC_SIGS_REQUIRED:
+			CHECK(readInt(txn, NULL));
+			txn->ucField = UC_TIMELOCK;
+			return TXN_OK;
+		}
 	}
-	seek(txn, 32);
 }
 
-static void readPrefixedBytes(txn_state_t *txn) {
-	uint64_t len = readInt(txn);
-	seek(txn, len);
-}
-
-static void readUnlockConditions(txn_state_t *txn) {
-	readInt(txn); // Timelock
-	uint64_t numKeys = readInt(txn); // PublicKeys
-	while (numKeys --> 0) {
-		seek(txn, 16);          // Algorithm
-		readPrefixedBytes(txn); // Key
+// readAnyCoveredFields decodes the CoveredFields of a TransactionSignature
+// that is covered by a partial signature, which may list indices of its own:
+// WholeTransaction, followed by ten slices of indices. txn->ucField tracks
+// the number of slices started, and txn->numKeys the indices remaining in the
+// current one.
+static txnDecoderState_e readAnyCoveredFields(txn_state_t *txn) {
+	uint8_t *field;
+	if (txn->ucField == 0) {
+		CHECK(need_at_least(txn, 1, &field));
+		if (field[0] > 1) {
+			return TXN_STATE_ERR;
+		}
+		consume(txn, field, 1);
+		txn->ucField = 1;
+		txn->numKeys = 0;
+	}
+	for (;;) {
+		if (txn->numKeys > 0) {
+			CHECK(readInt(txn, NULL));
+			txn->numKeys--;
+		} else if (txn->ucField <= 10) {
+			CHECK(readInt(txn, &txn->numKeys));
+			txn->ucField++;
+		} else {
+			txn->ucField = 0;
+			return TXN_OK;
+		}
 	}
-	readInt(txn); // SignaturesRequired
 }
 
-static void readCoveredFields(txn_state_t *txn) {
-	need_at_least(txn, 1);
+static txnDecoderState_e readCoveredFields(txn_state_t *txn) {
+	if (txn->mode == TXN_MODE_PARTIAL) {
+		return readAnyCoveredFields(txn);
+	}
+	// WholeTransaction, followed by ten empty slices
+	uint8_t *field;
+	CHECK(need_at_least(txn, 1 + 10*8, &field));
 	// for now, we require WholeTransaction = true
-	if (txn->buf[txn->pos] != 1) {
-		THROW(TXN_STATE_ERR);
+	if (field[0] != 1) {
+		return TXN_STATE_ERR;
 	}
-	seek(txn, 1);
 	// all other fields must be empty
 	for (int i = 0; i < 10; i++) {
-		if (readInt(txn) != 0) {
-			THROW(TXN_STATE_ERR);
+		if (U8LE(field, 1 + i*8) != 0) {
+			return TXN_STATE_ERR;
 		}
 	}
+	consume(txn, field, 1 + 10*8);
+	return TXN_OK;
+}
+
+// readSigHeader reads the ParentID, PublicKeyIndex, and Timelock of a
+// TransactionSignature. Everything hashed before the TransactionSignatures is
+// shared by every SigHash, so the header is all we need to keep in order to
+// compute its SigHash later. We always keep the header of a requested
+// signature; other headers are kept only if there is room to spare after
+// reserving a slot for each requested signature still to come.
+static txnDecoderState_e readSigHeader(txn_state_t *txn) {
+	uint8_t *field;
+	CHECK(need_at_least(txn, 48, &field));
+	bool requested = txn->sigsDone < txn->numSigs && txn->sliceIndex == txn->sigIndices[txn->sigsDone];
+	if (requested) {
+		txn->sigsDone++;
+	}
+	if (requested || txn->numSigHeaders + (txn->numSigs - txn->sigsDone) < TXN_MAX_SIGS) {
+		memmove(txn->sigHeaders[txn->numSigHeaders], field, 48);
+		txn->sigHeaderIndices[txn->numSigHeaders] = txn->sliceIndex;
+		txn->numSigHeaders++;
+	}
+	drain(txn, 48);
+	return TXN_OK;
 }
 
 static void addReplayProtection(cx_blake2b_t *S) {
@@ -192,146 +273,246 @@ static void addReplayProtection(cx_blake2b_t *S) {
 	blake2b_update(S, replayPrefix, 1);
 }
 
-// throws txnDecoderState_e
-static void __txn_next_elem(txn_state_t *txn) {
+// finishElem advances to the next element of the current slice.
+static void finishElem(txn_state_t *txn) {
+	txn->sliceIndex++;
+	txn->elemField = 0;
+}
+
+// readyElem finishes an element that should be displayed.
+static txnDecoderState_e readyElem(txn_state_t *txn) {
+	finishElem(txn);
+	txn->elem.type = txn->elemType;
+	txn->elem.index = txn->sliceIndex;
+	return TXN_STATE_READY;
+}
+
+// decodeElem decodes the next element of the transaction, returning TXN_OK
+// if it should not be displayed, or a txnDecoderState_e otherwise.
+//
+// Each field is added to the hash and drained from the buffer as soon as it
+// is decoded, and txn->elemField records how many fields of the current
+// element have been decoded so far. If we run out of data mid-element, the
+// next call picks up at the first undecoded field instead of re-parsing the
+// element from its first byte. (The switch statements below rely on
+// fallthrough for this.)
+static txnDecoderState_e decodeElem(txn_state_t *txn) {
+	uint8_t *field;
 	// if we're on a slice boundary, read the next length prefix and bump the
 	// element type
 	while (txn->sliceIndex == txn->sliceLen) {
 		if (txn->elemType == TXN_ELEM_TXN_SIG) {
-			// store final hash
-			blake2b_final(&txn->blake, txn->sigHash, sizeof(txn->sigHash));
-			THROW(TXN_STATE_FINISHED);
+			// all requested SigHashes have been computed
+			txn->finished = true;
+			return TXN_STATE_FINISHED;
 		}
-		txn->sliceLen = readInt(txn);
+		CHECK(need_at_least(txn, 8, &field));
+		txn->sliceLen = U8LE(field, 0);
 		txn->sliceIndex = 0;
 		txn->elemType++;
-		advance(txn);
-
-		// if we've reached the TransactionSignatures, check that sigIndex is
-		// a valid index
-		if ((txn->elemType == TXN_ELEM_TXN_SIG) && (txn->sigIndex >= txn->sliceLen)) {
-			THROW(TXN_STATE_ERR);
+		// the length prefix of the TransactionSignatures is not covered, and
+		// a partial signature covers no length prefixes at all
+		if (txn->elemType != TXN_ELEM_TXN_SIG && txn->mode != TXN_MODE_PARTIAL) {
+			blake2b_update(&txn->blake, field, 8);
+		}
+		drain(txn, 8);
+
+		// if we've reached the TransactionSignatures, check that every
+		// sigIndex is a valid index (they are sorted, so just check the
+		// last). A partial transaction only contains the covered
+		// TransactionSignatures, so there's nothing to check.
+		if ((txn->elemType == TXN_ELEM_TXN_SIG) && (txn->mode != TXN_MODE_PARTIAL) && (txn->sigIndices[txn->numSigs-1] >= txn->sliceLen)) {
+			return TXN_STATE_ERR;
 		}
 	}
 
 	switch (txn->elemType) {
 	// these elements should be displayed
 	case TXN_ELEM_SC_OUTPUT:
-		readCurrency(txn, txn->outVal); // Value
-		readHash(txn, txn->outAddr);    // UnlockHash
-		advance(txn);
-		txn->sliceIndex++;
-		THROW(TXN_STATE_READY);
+		switch (txn->elemField) {
+		case 0:
+			CHECK(readCurrency(txn, &txn->scTotal)); // Value
+			txn->elemField++;
+			// fallthrough
+		case 1:
+			CHECK(readHash(txn, txn->elem.out.hash));    // UnlockHash
+		}
+		return readyElem(txn);
 
 	case TXN_ELEM_SF_OUTPUT:
-		readCurrency(txn, txn->outVal); // Value
-		readHash(txn, txn->outAddr);    // UnlockHash
-		readCurrency(txn, NULL);        // ClaimStart
-		advance(txn);
-		txn->sliceIndex++;
-		THROW(TXN_STATE_READY);
+		switch (txn->elemField) {
+		case 0:
+			CHECK(readCurrency(txn, &txn->sfTotal)); // Value
+			txn->elemField++;
+			// fallthrough
+		case 1:
+			CHECK(readHash(txn, txn->elem.out.hash));    // UnlockHash
+			txn->elemField++;
+			// fallthrough
+		case 2:
+			CHECK(readPrefixedBytes(txn, NULL, 0)); // ClaimStart
+		}
+		return readyElem(txn);
 
 	case TXN_ELEM_MINER_FEE:
-		readCurrency(txn, txn->outVal); // Value
-		memmove(txn->outAddr, "[Miner Fee]", 12);
-		advance(txn);
-		txn->sliceIndex++;
-		THROW(TXN_STATE_READY);
+		CHECK(readCurrency(txn, &txn->feeTotal)); // Value
+		return readyElem(txn);
+
+	case TXN_ELEM_ARB_DATA:
+		// arbitrary data may be very large, so it is streamed into the hash,
+		// keeping only a short preview for display
+		CHECK(readPrefixedBytes(txn, txn->elem.arb.preview, sizeof(txn->elem.arb.preview))); // Data
+		txn->elem.arb.len = txn->prefixTotal;
+		return readyElem(txn);
 
 	// these elements should be decoded, but not displayed
 	case TXN_ELEM_SC_INPUT:
-		readHash(txn, NULL);       // ParentID
-		readUnlockConditions(txn); // UnlockConditions
-		addReplayProtection(&txn->blake);
-		advance(txn);
-		txn->sliceIndex++;
-		return;
+		switch (txn->elemField) {
+		case 0:
+			addReplayProtection(&txn->blake);
+			txn->elemField++;
+			// fallthrough
+		case 1:
+			CHECK(readHash(txn, NULL));       // ParentID
+			txn->elemField++;
+			// fallthrough
+		case 2:
+			CHECK(readUnlockConditions(txn)); // UnlockConditions
+		}
+		finishElem(txn);
+		return TXN_OK;
 
 	case TXN_ELEM_SF_INPUT:
-		readHash(txn, NULL);       // ParentID
-		readUnlockConditions(txn); // UnlockConditions
-		readHash(txn, NULL);       // ClaimUnlockHash
-		addReplayProtection(&txn->blake);
-		advance(txn);
-		txn->sliceIndex++;
-		return;
+		switch (txn->elemField) {
+		case 0:
+			addReplayProtection(&txn->blake);
+			txn->elemField++;
+			// fallthrough
+		case 1:
+			CHECK(readHash(txn, NULL));       // ParentID
+			txn->elemField++;
+			// fallthrough
+		case 2:
+			CHECK(readUnlockConditions(txn)); // UnlockConditions
+			txn->elemField++;
+			// fallthrough
+		case 3:
+			CHECK(readHash(txn, NULL));       // ClaimUnlockHash
+		}
+		finishElem(txn);
+		return TXN_OK;
 
 	case TXN_ELEM_TXN_SIG:
-		readHash(txn, NULL);    // ParentID
-		readInt(txn);           // PublicKeyIndex
-		readInt(txn);           // Timelock
-		readCoveredFields(txn); // CoveredFields
-		readPrefixedBytes(txn); // Signature
-		advance(txn);
-		txn->sliceIndex++;
-		return;
+		if (txn->mode == TXN_MODE_SIG_HEADERS) {
+			// Only the headers of the requested signatures are present, in
+			// order, so the slice index of each comes from sigIndices. After
+			// the last one, jump to the end of the slice.
+			txn->sliceIndex = txn->sigIndices[txn->sigsDone];
+			CHECK(readSigHeader(txn)); // ParentID, PublicKeyIndex, Timelock
+			txn->sliceIndex = (txn->sigsDone < txn->numSigs) ? txn->sigIndices[txn->sigsDone] : txn->sliceLen;
+			return TXN_OK;
+		}
+		switch (txn->elemField) {
+		case 0:
+			if (txn->mode == TXN_MODE_PARTIAL) {
+				// a covered signature is hashed in full, and its header
+				// is of no further use
+				CHECK(need_at_least(txn, 48, &field));
+				consume(txn, field, 48);
+			} else {
+				CHECK(readSigHeader(txn)); // ParentID, PublicKeyIndex, Timelock
+			}
+			txn->elemField++;
+			// fallthrough
+		case 1:
+			CHECK(readCoveredFields(txn)); // CoveredFields
+			txn->elemField++;
+			// fallthrough
+		case 2:
+			CHECK(readPrefixedBytes(txn, NULL, 0)); // Signature
+		}
+		finishElem(txn);
+		return TXN_OK;
 
 	// these elements should not be present
 	case TXN_ELEM_FC:
 	case TXN_ELEM_FCR:
 	case TXN_ELEM_SP:
-	case TXN_ELEM_ARB_DATA:
 		if (txn->sliceLen != 0) {
-			THROW(TXN_STATE_ERR);
+			return TXN_STATE_ERR;
 		}
-		return;
+		return TXN_OK;
 	}
+	return TXN_STATE_ERR;
 }
 
 
 txnDecoderState_e txn_next_elem(txn_state_t *txn) {
-	// Like many transaction decoders, we use exceptions to jump out of deep
-	// call stacks when we encounter an error. There are two important rules
-	// for Ledger exceptions: declare modified variables as volatile, and do
-	// not THROW(0). Presumably, 0 is the sentinel value for "no exception
-	// thrown." So be very careful when throwing enums, since enums start at 0
-	// by default.
-	volatile txnDecoderState_e result;
-	BEGIN_TRY {
-		TRY {
-			// read until we reach a displayable element or the end of the buffer
-			for (;;) {
-				__txn_next_elem(txn);
-			}
-		}
-		CATCH_OTHER(e) {
-			result = e;
-		}
-		FINALLY {
-		}
-	}
-	END_TRY;
-	if (txn->buflen + 255 > sizeof(txn->buf)) {
-		// we filled the buffer to max capacity, but there still wasn't enough
-		// to decode a full element. This generally means that the txn is
-		// corrupt in some way, since elements shouldn't be very large.
-		return TXN_STATE_ERR;
-	}
+	// Many transaction decoders use exceptions to jump out of deep call
+	// stacks when they need more data or encounter an error. On the Ledger,
+	// however, exceptions are implemented with setjmp/longjmp, so every
+	// element would pay for saving and restoring the register file. Instead,
+	// each decoding function returns its state, and CHECK propagates it.
+	//
+	// read until we reach a displayable element or the end of the buffer
+	txnDecoderState_e result;
+	while ((result = decodeElem(txn)) == TXN_OK);
 	return result;
 }
 
-void txn_init(txn_state_t *txn, uint16_t sigIndex) {
+void txn_init(txn_state_t *txn, const uint16_t *sigIndices, uint8_t numSigs, txnMode_e mode) {
 	memset(txn, 0, sizeof(txn_state_t));
-	txn->buflen = txn->pos = txn->sliceIndex = txn->sliceLen = txn->valLen = 0;
+	txn->buflen = txn->inlen = txn->bytesCopied = txn->sliceIndex = txn->sliceLen = 0;
+	txn->elemField = txn->ucField = txn->numKeys = txn->prefixLen = txn->prefixTotal = txn->inPrefix = 0;
 	txn->elemType = -1; // first increment brings it to SC_INPUT
-	txn->sigIndex = sigIndex;
+	memmove(txn->sigIndices, sigIndices, numSigs * sizeof(uint16_t));
+	txn->numSigs = numSigs;
+	txn->mode = mode;
+	txn->sigsDone = 0;
+	txn->numSigHeaders = 0;
+	txn->finished = false;
 
 	// initialize hash state
 	blake2b_init(&txn->blake);
 }
 
-void txn_update(txn_state_t *txn, uint8_t *in, uint8_t inlen) {
-	// the buffer should never overflow; any elements should always be drained
-	// before the next read.
-	if (txn->buflen + inlen > sizeof(txn->buf)) {
-		THROW(SW_DEVELOPER_ERR);
+bool txn_sighash(txn_state_t *txn, uint16_t sigIndex, uint8_t *out) {
+	if (!txn->finished) {
+		return false;
 	}
+	if (txn->mode == TXN_MODE_PARTIAL) {
+		// A partial SigHash covers only the covered elements, so it is
+		// simply the hash of everything decoded.
+		if (sigIndex != txn->sigIndices[0]) {
+			return false;
+		}
+		cx_blake2b_t S = txn->blake;
+		blake2b_final(&S, out, 32);
+		return true;
+	}
+	for (int i = 0; i < txn->numSigHeaders; i++) {
+		if (txn->sigHeaderIndices[i] == sigIndex) {
+			// txn->blake still holds the hash of everything before the
+			// TransactionSignatures, so we finish the SigHash from a copy,
+			// leaving txn->blake untouched for the next one.
+			cx_blake2b_t S = txn->blake;
+			blake2b_update(&S, txn->sigHeaders[i], 48);
+			blake2b_final(&S, out, 32);
+			return true;
+		}
+	}
+	return false;
+}
 
-	// append to the buffer
-	memmove(txn->buf + txn->buflen, in, inlen);
-	txn->buflen += inlen;
+void txn_update(txn_state_t *txn, uint8_t *in, uint16_t inlen) {
+	// the previous input should always be consumed (or copied into buf)
+	// before the next chunk arrives.
+	if (txn->inlen != 0) {
+		THROW(SW_DEVELOPER_ERR);
+	}
 
-	// reset the seek position; if we previously threw TXN_STATE_PARTIAL, now
-	// we can try decoding again from the beginning.
-	txn->pos = 0;
+	// the decoder reads directly from in, so it must remain valid until
+	// txn_next_elem returns TXN_STATE_PARTIAL.
+	txn->in = in;
+	txn->inlen = inlen;
 }
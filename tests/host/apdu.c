@@ -0,0 +1,119 @@
+// apdu runs sia_main, the top part of main.c (which run.sh copies into
+// main_top.c), on a script of request APDUs, and checks how each one is
+// framed: the payload length the handler is given, or the error code sent
+// instead. It is built with the Nano S's short APDU buffer and with the Nano
+// X's extended one (IO_APDU_BUFFER_SIZE=2055).
+
+#include "main_top.c"
+
+unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+
+void clearSigningKey(void) {}
+void ux_stack_push(void) {}
+void ux_flow_init(int i, const int *const *flow, void *x) {}
+void os_sched_exit(int exit_code) {}
+const int C_icon_validate, C_icon_crossmark, C_icon_back, C_icon_certificate, C_icon_dashboard;
+
+// Every handler replies with the length of its payload, and the sum of its
+// bytes, which catches a payload read from the wrong offset. (Each case's
+// payload is the bytes 1, 2, 3, ...)
+static void echoLength(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+	uint8_t sum = 0;
+	for (int i = 0; i < dataLength; i++) {
+		sum += dataBuffer[i];
+	}
+	G_io_apdu_buffer[0] = dataLength >> 8;
+	G_io_apdu_buffer[1] = dataLength & 0xFF;
+	G_io_apdu_buffer[2] = sum;
+	io_exchange_with_code(SW_OK, 3);
+}
+handler_fn_t handleGetVersion __attribute__((alias("echoLength")));
+handler_fn_t handleGetPublicKey __attribute__((alias("echoLength")));
+handler_fn_t handleSignHash __attribute__((alias("echoLength")));
+handler_fn_t handleCalcTxnHash __attribute__((alias("echoLength")));
+
+typedef struct {
+	const char *name;
+	uint8_t lc[3];  // the LC byte, and the extended length if lc[0] is 0
+	int lcLen;      // number of bytes of lc sent
+	int dataLen;    // payload bytes actually sent
+	int shortWant;  // payload length the handler is given, or the error code (>= 0x6000)
+	int extWant;    // the same, with an extended APDU buffer
+} apduCase_t;
+
+static const apduCase_t cases[] = {
+	{"short",                  {3},           1, 3,   3,      3},
+	{"short, empty",           {0},           1, 0,   0,      0},
+	{"no LC",                  {0},           0, 0,   0x6700, 0x6700},
+	{"short, largest",         {255},         1, 255, 255,    255},
+	{"short, LC > data",       {10},          1, 3,   0x6700, 0x6700},
+	{"short, LC = 255 > data", {255},         1, 254, 0x6700, 0x6700},
+	{"extended",               {0, 0, 5},     3, 5,   0x6700, 5},
+	{"extended, truncated LC", {0, 1},        2, 0,   0x6700, 0x6700},
+	{"extended, LC > data",    {0, 8, 0},     3, 10,  0x6700, 0x6700},
+	{"extended, LC = 0xFFFF",  {0, 255, 255}, 3, 200, 0x6700, 0x6700},
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static int next;       // index of the next case to send
+static int got[NUM_CASES];
+
+// io_exchange records the reply to the previous case (if any), and then,
+// unless IO_RETURN_AFTER_TX is set, loads the next case into
+// G_io_apdu_buffer. When the cases run out, it returns 0, which makes
+// sia_main throw EXCEPTION_IO_RESET.
+unsigned short io_exchange(unsigned char channel_and_flags, unsigned short tx_len) {
+	if (tx_len >= 2 && next > 0) {
+		uint16_t sw = U2BE(G_io_apdu_buffer, tx_len - 2);
+		got[next-1] = sw;
+		if (sw == SW_OK && tx_len == 5) {
+			uint16_t len = U2BE(G_io_apdu_buffer, 0);
+			uint8_t sum = 0;
+			for (int i = 0; i < len; i++) {
+				sum += i + 1;
+			}
+			got[next-1] = (G_io_apdu_buffer[2] == sum) ? len : -1;
+		}
+	}
+	if (channel_and_flags & IO_RETURN_AFTER_TX) {
+		return 0;
+	}
+	if (next == NUM_CASES) {
+		return 0;
+	}
+	const apduCase_t *c = &cases[next++];
+	uint8_t *p = G_io_apdu_buffer;
+	*p++ = CLA;
+	*p++ = INS_GET_TXN_HASH;
+	*p++ = 0;
+	*p++ = 0;
+	memmove(p, c->lc, c->lcLen);
+	p += c->lcLen;
+	for (int i = 0; i < c->dataLen; i++) {
+		*p++ = i + 1;
+	}
+	return p - G_io_apdu_buffer;
+}
+
+int main(void) {
+	BEGIN_TRY {
+		TRY {
+			sia_main();
+		}
+		CATCH(EXCEPTION_IO_RESET) {
+		}
+		FINALLY {
+		}
+	}
+	END_TRY;
+
+	int fail = 0;
+	for (int i = 0; i < NUM_CASES; i++) {
+		int want = (IO_APDU_BUFFER_SIZE > APDU_MAX_SHORT) ? cases[i].extWant : cases[i].shortWant;
+		if (got[i] != want) {
+			printf("%s: got %#x, want %#x\n", cases[i].name, got[i], want);
+			fail = 1;
+		}
+	}
+	return fail;
+}
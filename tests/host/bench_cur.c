@@ -0,0 +1,126 @@
+// bench_cur checks cur_fmt against the baseline one-digit-per-pass cur2dec
+// over 1000 values of each length from 0 to 18 bytes and the powers of ten
+// up to 10^43 (plus and minus one). With the argument "time", it then times
+// both per value length.
+
+#include <os.h>
+#include <time.h>
+#include "blake2b.h"
+#include "sia.h"
+#include "cur2dec_old.inc"
+
+// a Sia-encoded value: 8-byte length prefix (only the first byte is used
+// here), then the big-endian value
+typedef struct {
+	uint8_t enc[8+18];
+	cur_t c;
+} value_t;
+
+static uint64_t rng = 88172645463325252ULL;
+static uint64_t xorshift(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+// makeValue encodes a big-endian value as Sia does, without leading zeros.
+static void makeValue(value_t *v, const uint8_t *be, uint8_t len) {
+	while (len > 0 && be[0] == 0) {
+		be++;
+		len--;
+	}
+	memset(v, 0, sizeof(*v));
+	v->enc[0] = len;
+	memcpy(v->enc+8, be, len);
+	cur_add(&v->c, be, len);
+}
+
+static bool same(value_t *v) {
+	uint8_t a[128], b[128];
+	int la = cur2dec_old(a, v->enc);
+	int lb = cur_fmt(b, &v->c);
+	if (la != lb || memcmp(a, b, la+1) != 0) {
+		printf("mismatch: old=%s new=%s\n", a, b);
+		return false;
+	}
+	return true;
+}
+
+static uint64_t now(void) {
+#if defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000ULL + t.tv_nsec;
+#endif
+}
+
+#define N 1000
+#define REPS 200
+
+int main(int argc, char **argv) {
+	static value_t vals[19][N];
+	long bad = 0;
+	for (int len = 0; len <= 18; len++) {
+		for (int k = 0; k < N; k++) {
+			// the first three values of each length are all-ones,
+			// a lone low bit in the top byte, and a lone high bit
+			uint8_t be[18];
+			for (int j = 0; j < len; j++) {
+				be[j] = (k == 0) ? 0xFF : (k == 1) ? (j == 0) : (k == 2) ? (j == 0)<<7 : xorshift();
+			}
+			if (len > 0 && be[0] == 0) {
+				be[0] = 1;
+			}
+			makeValue(&vals[len][k], be, len);
+			bad += !same(&vals[len][k]);
+		}
+	}
+	for (int p = 0; p < 44; p++) {
+		for (int d = -1; d <= 1; d++) {
+			unsigned __int128 x = 1;
+			for (int j = 0; j < p; j++) {
+				x *= 10;
+			}
+			x += d;
+			uint8_t be[18] = {0};
+			for (int j = 0; j < 16; j++) {
+				be[2+j] = x >> (8*(15-j));
+			}
+			value_t v;
+			makeValue(&v, be, 18);
+			bad += !same(&v);
+		}
+	}
+	printf("mismatches: %ld\n", bad);
+	if (bad != 0 || argc < 2 || strcmp(argv[1], "time") != 0) {
+		return bad != 0;
+	}
+
+#if defined(__x86_64__)
+	printf("len  old(cyc)  new(cyc)\n");
+#else
+	printf("len   old(ns)   new(ns)\n");
+#endif
+	for (int len = 1; len <= 18; len++) {
+		uint8_t out[128];
+		volatile int sink = 0;
+		uint64_t t0 = now();
+		for (int r = 0; r < REPS; r++) {
+			for (int k = 3; k < N; k++) {
+				sink += cur2dec_old(out, vals[len][k].enc);
+			}
+		}
+		uint64_t t1 = now();
+		for (int r = 0; r < REPS; r++) {
+			for (int k = 3; k < N; k++) {
+				sink += cur_fmt(out, &vals[len][k].c);
+			}
+		}
+		uint64_t t2 = now();
+		printf("%3d %9.1f %9.1f\n", len, (t1-t0)/(REPS*(N-3.0)), (t2-t1)/(REPS*(N-3.0)));
+	}
+	return 0;
+}
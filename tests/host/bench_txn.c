@@ -0,0 +1,41 @@
+// bench_txn REPS decodes the transaction on stdin REPS times in 255-byte
+// chunks and prints the number of displayed elements per second, along with
+// the bytes txn_update copied into the decoder buffer per transaction.
+
+#include <os.h>
+#include <time.h>
+#include "blake2b.h"
+#include "sia.h"
+
+int main(int argc, char **argv) {
+	static uint8_t data[1<<20];
+	static txn_state_t txn;
+	int n = fread(data, 1, sizeof(data), stdin);
+	long reps = atol(argv[1]);
+	long elems = 0;
+	uint16_t sigIndex = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long rep = 0; rep < reps; rep++) {
+		txn_init(&txn, &sigIndex, 1, TXN_MODE_WHOLE);
+		int off = 0;
+		for (;;) {
+			txnDecoderState_e state = txn_next_elem(&txn);
+			if (state == TXN_STATE_PARTIAL) {
+				int k = (n - off < 255) ? n - off : 255;
+				txn_update(&txn, data + off, k);
+				off += k;
+				continue;
+			} else if (state != TXN_STATE_READY) {
+				break;
+			}
+			elems++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+	printf("%.2fM displayed elems/s, %u bytes copied per txn\n", elems/secs/1e6, txn.bytesCopied);
+	return 0;
+}
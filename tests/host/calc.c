@@ -0,0 +1,311 @@
+// calc drives handleCalcTxnHash through the exchanges that a computer and a
+// user would have with it. calcTxnHash.c is included directly, so that its
+// button handlers can be pressed.
+//
+// calc CHUNK SIGS P2 reads a transaction from stdin and plays a whole
+// session: the computer sends the transaction in CHUNK-byte packets (fewer
+// if they don't fit in a short APDU; the rest of the buffer is poisoned),
+// asking for the SigHash of each index in the comma-separated SIGS, with the
+// given P2 flags; whenever it is waiting for a reply, the user presses the
+// button on the screen. It prints
+// every element the user reviews, the totals if a summary is shown, and the
+// SigHashes (or, when signing, the hash in each stub signature; see
+// sdk_stubs.c), in the format gentxn.py writes to expect.txt.
+//
+// calc scenarios SIGS runs the scenario checks in main instead, which
+// interrupt such sessions in various ways, using the transaction on stdin
+// (which must have enough outputs to fill the element queue).
+
+#include "calcTxnHash.c"
+#include "print.h"
+
+unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+commandContext global;
+const int C_icon_validate, C_icon_crossmark, C_icon_back, C_icon_certificate, C_icon_dashboard;
+
+static const int *const *curFlow; // the flow on screen, or NULL for the main menu
+static int replies;               // number of replies sent
+static uint16_t lastCode;         // code of the most recent reply
+static uint8_t resp[IO_APDU_BUFFER_SIZE];
+static uint16_t respLen;          // length of the most recent reply, without the code
+
+static void reply(uint16_t code, uint16_t tx) {
+	replies++;
+	lastCode = code;
+	memmove(resp, G_io_apdu_buffer, tx);
+	respLen = tx;
+}
+
+void io_exchange_with_code(uint16_t code, uint16_t tx) {
+	reply(code, tx);
+}
+
+unsigned int io_seproxyhal_cancel(void) {
+	clearSigningKey();
+	io_exchange_with_code(SW_USER_REJECTED, 0);
+	ui_idle();
+	return 0;
+}
+
+void ui_idle(void) {
+	curFlow = NULL;
+}
+
+void ux_flow_init(int i, const int *const *flow, void *x) {
+	curFlow = flow;
+}
+
+// MAX_PAYLOAD is the largest payload of a short APDU, which is all that
+// calc sends.
+#define MAX_PAYLOAD 255
+
+// call sends a request APDU to the handler, with its payload placed in
+// G_io_apdu_buffer as sia_main would find it. It returns the code of the
+// reply, or 0 if the reply was deferred. If the handler replies more than
+// once, or neither replies nor defers, it returns -1.
+static int call(uint8_t p1, uint8_t p2, uint8_t *data, uint16_t len) {
+	static uint8_t payload[MAX_PAYLOAD];
+	memmove(payload, data, len);
+	memset(G_io_apdu_buffer, 0xAA, sizeof(G_io_apdu_buffer));
+	uint8_t *cdata = G_io_apdu_buffer + 5;
+	memmove(cdata, payload, len);
+
+	volatile unsigned int flags = 0, tx = 0;
+	int r0 = replies;
+	BEGIN_TRY {
+		TRY {
+			handleCalcTxnHash(p1, p2, cdata, len, &flags, &tx);
+		}
+		CATCH_OTHER(e) {
+			reply(e, tx);
+		}
+		FINALLY {
+		}
+	}
+	END_TRY;
+	if (replies == r0 + 1) {
+		return lastCode;
+	} else if (replies == r0 && (flags & IO_ASYNCH_REPLY)) {
+		return 0;
+	}
+	return -1;
+}
+
+static uint8_t data[1<<20]; // the transaction
+static int n;               // its length
+
+static uint16_t sigIndices[TXN_MAX_SIGS];
+static int numSigs;
+
+static bool quiet;              // don't print anything
+static uint8_t hashes[TXN_MAX_SIGS][32];
+static int numHashes;           // SigHashes received so far
+
+// gotHashes records the SigHashes (or signatures) in the most recent reply.
+static void gotHashes(bool sign) {
+	int size = sign ? 64 : 32;
+	for (int i = 0; i < respLen / size && numHashes < TXN_MAX_SIGS; i++) {
+		memmove(hashes[numHashes], resp + size*i + (sign ? 32 : 0), 32);
+		if (!quiet) {
+			printHash(hashes[numHashes]);
+		}
+		numHashes++;
+	}
+}
+
+// sendPacket sends the next packet of a session, starting at *off, and
+// advances *off past it. The first packet also carries the key and sig
+// indices.
+static int sendPacket(uint8_t p2, int chunk, int *off) {
+	static uint8_t packet[MAX_PAYLOAD];
+	int hdr = 0;
+	if (*off == 0) {
+		if (p2 & P2_MULTI) {
+			packet[hdr++] = numSigs;
+		}
+		for (int i = 0; i < numSigs; i++) {
+			uint32_t keyIndex = i + 1;
+			packet[hdr++] = keyIndex;
+			packet[hdr++] = keyIndex >> 8;
+			packet[hdr++] = keyIndex >> 16;
+			packet[hdr++] = keyIndex >> 24;
+			packet[hdr++] = sigIndices[i];
+			packet[hdr++] = sigIndices[i] >> 8;
+		}
+	} else if (p2 & P2_RESUMABLE) {
+		for (int i = 0; i < 4; i++) {
+			packet[i] = *off >> (8*i);
+		}
+		hdr = 4;
+	}
+	int k = (n - *off < chunk) ? n - *off : chunk;
+	if (k > MAX_PAYLOAD - hdr) {
+		k = MAX_PAYLOAD - hdr;
+	}
+	memmove(packet + hdr, data + *off, k);
+	int code = call(*off == 0 ? P1_FIRST : P1_MORE, p2, packet, hdr + k);
+	*off += k;
+	return code;
+}
+
+// session plays a whole session, as described above. It returns false,
+// after printing the reason, if the handler misbehaves.
+static bool session(uint8_t p2, int chunk) {
+	if (numSigs > 1) {
+		p2 |= P2_MULTI;
+	}
+	bool sign = p2 & P2_SIGN_HASH;
+	numHashes = 0;
+	int off = 0;
+	bool waiting = false; // for the reply to the last packet
+	for (int steps = 0; steps < 1000000; steps++) {
+		if (!waiting && (off == 0 || off < n)) {
+			int code = sendPacket(p2, chunk, &off);
+			if (code == 0) {
+				waiting = true;
+			} else if (code != SW_OK) {
+				printf("packet at %d: got %#x\n", off, code);
+				return false;
+			} else if (respLen > 0) {
+				gotHashes(sign);
+			}
+			continue;
+		}
+
+		// Otherwise, the user presses the button on the screen.
+		int r0 = replies;
+		if (curFlow == ux_show_txn_elem_flow) {
+			if (ctx->elemPart == 0 && !quiet) {
+				printElem(&ctx->queue[ctx->queueHead]);
+			}
+			ui_calcTxnHash_elem_button();
+		} else if (curFlow == ux_txn_summary_flow) {
+			if (ctx->elemPart == 0 && !quiet) {
+				printTotals(&ctx->txn);
+			}
+			ui_calcTxnHash_summary_button();
+		} else if (curFlow == ux_sign_txn_flow) {
+			io_seproxyhal_touch_txn_hash_ok();
+			while (lastCode == SW_OK && respLen > 0) {
+				gotHashes(true);
+				if (numHashes == numSigs || call(P1_NEXT, p2, NULL, 0) != SW_OK) {
+					break;
+				}
+			}
+			break;
+		} else if (curFlow == ux_compare_hash_flow) {
+			break;
+		} else {
+			printf("stuck at %d of %d (waiting: %d)\n", off, n, waiting);
+			return false;
+		}
+		if (replies > r0) {
+			if (!waiting || replies > r0 + 1 || lastCode != SW_OK) {
+				printf("unexpected reply %#x\n", lastCode);
+				return false;
+			}
+			waiting = false;
+			if (respLen > 0) {
+				gotHashes(sign);
+			}
+		}
+	}
+	if (numHashes != numSigs) {
+		printf("got %d of %d SigHashes\n", numHashes, numSigs);
+		return false;
+	}
+	return true;
+}
+
+// interrupt starts a session and stops once a packet's reply is deferred,
+// i.e. while the decoder still holds onto that packet.
+static bool interrupt(void) {
+	int off = 0;
+	while (off < n) {
+		int code = sendPacket(P2_DISPLAY_HASH, 250, &off);
+		if (code == 0) {
+			return ctx->replyPending;
+		} else if (code != SW_OK) {
+			return false;
+		}
+	}
+	return false;
+}
+
+#define EXPECT(cond, msg) do { if (!(cond)) { printf("FAIL: %s\n", msg); fail = 1; } } while (0)
+
+static int scenarios(void) {
+	int fail = 0;
+	quiet = true;
+	EXPECT(session(P2_DISPLAY_HASH, 250), "clean session");
+	uint8_t want[TXN_MAX_SIGS][32];
+	memmove(want, hashes, sizeof(want));
+
+	// Any command sent while a reply is deferred has overwritten the packet
+	// the decoder is reading. The transaction must be
+	// dropped, and the next one must go through as usual.
+	static const struct {
+		const char *name;
+		uint8_t p1;
+		uint8_t p2;
+		uint8_t len;
+		uint16_t code;
+	} cmds[] = {
+		{"P1_MORE",     P1_MORE,   0, 100, SW_IMPROPER_INIT},
+		{"P1_NEXT",     P1_NEXT,   0, 0,   SW_IMPROPER_INIT},
+		{"P1_EXPORT",   P1_EXPORT, 0, 2,   SW_IMPROPER_INIT},
+		{"P1_IMPORT",   P1_IMPORT, 0, 50,  SW_IMPROPER_INIT},
+		{"P1_REUSE",    P1_REUSE,  0, 6,   SW_IMPROPER_INIT},
+		{"invalid P1",  0x7F,      0, 0,   SW_IMPROPER_INIT},
+		{"invalid P2",  P1_MORE,   P2_HASH_ONLY | P2_SIGN_HASH, 0, SW_IMPROPER_INIT},
+		{"P1_ABORT",    P1_ABORT,  0, 0,   SW_OK},
+	};
+	for (int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+		char msg[100];
+		snprintf(msg, sizeof(msg), "%s: reply deferred", cmds[i].name);
+		EXPECT(interrupt(), msg);
+		uint8_t junk[100];
+		memset(junk, 0x55, sizeof(junk));
+		junk[0] = 2; // an offset, for P1_EXPORT and P1_IMPORT
+		junk[1] = 0;
+		int code = call(cmds[i].p1, cmds[i].p2, junk, cmds[i].len);
+		snprintf(msg, sizeof(msg), "%s: got %#x, want %#x", cmds[i].name, code, cmds[i].code);
+		EXPECT(code == cmds[i].code, msg);
+		snprintf(msg, sizeof(msg), "%s: transaction dropped", cmds[i].name);
+		EXPECT(!ctx->initialized && !ctx->replyPending && curFlow == NULL, msg);
+		snprintf(msg, sizeof(msg), "%s: next transaction", cmds[i].name);
+		EXPECT(session(P2_DISPLAY_HASH, 250) && memcmp(hashes, want, sizeof(want)) == 0, msg);
+	}
+
+	// A token import that is abandoned part-way, by starting a new
+	// transaction or by P1_ABORT, must not keep the next transaction from
+	// being signed.
+	for (int abort = 0; abort < 2; abort++) {
+		const char *how = abort ? "import, P1_ABORT" : "import";
+		char msg[100];
+		uint8_t part[52] = {0, 0}; // offset 0, followed by the start of a token
+		snprintf(msg, sizeof(msg), "%s: part of a token accepted", how);
+		EXPECT(call(P1_IMPORT, 0, part, sizeof(part)) == SW_OK && ctx->importing, msg);
+		if (abort) {
+			EXPECT(call(P1_ABORT, 0, NULL, 0) == SW_OK, "P1_ABORT after import");
+		}
+		snprintf(msg, sizeof(msg), "%s: next transaction signed", how);
+		EXPECT(session(P2_SIGN_HASH, 250) && memcmp(hashes, want, sizeof(want)) == 0, msg);
+		uint8_t reuse[6] = {1, 0, 0, 0, sigIndices[0], sigIndices[0] >> 8};
+		snprintf(msg, sizeof(msg), "%s: P1_REUSE", how);
+		EXPECT(call(P1_REUSE, P2_SIGN_HASH, reuse, sizeof(reuse)) == SW_OK, msg);
+	}
+	return fail;
+}
+
+int main(int argc, char **argv) {
+	n = fread(data, 1, sizeof(data), stdin);
+	bool runScenarios = (strcmp(argv[1], "scenarios") == 0);
+	for (char *t = strtok(argv[2], ","); t && numSigs < TXN_MAX_SIGS; t = strtok(NULL, ",")) {
+		sigIndices[numSigs++] = atoi(t);
+	}
+	if (runScenarios) {
+		return scenarios();
+	}
+	return session(atoi(argv[3]), atoi(argv[1])) ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// decode CHUNK SIGS [p|h] reads a transaction from stdin, feeds it to the
+// decoder CHUNK bytes at a time, and prints every displayed element, the
+// totals, and the sighash for each index in the comma-separated SIGS, in the
+// format gentxn.py writes to expect.txt. The optional third argument selects
+// TXN_MODE_PARTIAL (p) or TXN_MODE_SIG_HEADERS (h) instead of
+// TXN_MODE_WHOLE.
+
+#include <os.h>
+#include "blake2b.h"
+#include "sia.h"
+#include "print.h"
+
+int main(int argc, char **argv) {
+	static uint8_t data[1<<20];
+	static uint8_t apdu[4096];
+	static txn_state_t txn;
+	int n = fread(data, 1, sizeof(data), stdin);
+	int chunk = atoi(argv[1]);
+	uint16_t sigIndices[8];
+	int numSigs = 0;
+	for (char *t = strtok(argv[2], ","); t && numSigs < 8; t = strtok(NULL, ",")) {
+		sigIndices[numSigs++] = atoi(t);
+	}
+	txnMode_e mode = TXN_MODE_WHOLE;
+	if (argc > 3) {
+		mode = (argv[3][0] == 'p') ? TXN_MODE_PARTIAL : TXN_MODE_SIG_HEADERS;
+	}
+	txn_init(&txn, sigIndices, numSigs, mode);
+
+	int off = 0;
+	for (;;) {
+		txnDecoderState_e state = txn_next_elem(&txn);
+		if (state == TXN_STATE_PARTIAL) {
+			if (off >= n) {
+				printf("underflow\n");
+				return 1;
+			}
+			// poison the rest of the buffer, so that reads past the
+			// chunk are visible in the output
+			int k = (n - off < chunk) ? n - off : chunk;
+			memset(apdu, 0xAA, sizeof(apdu));
+			memcpy(apdu, data + off, k);
+			txn_update(&txn, apdu, k);
+			off += k;
+			continue;
+		} else if (state == TXN_STATE_ERR) {
+			printf("err\n");
+			return 1;
+		} else if (state == TXN_STATE_FINISHED) {
+			break;
+		}
+
+		printElem(&txn.elem);
+	}
+	printTotals(&txn);
+
+	uint8_t hash[32];
+	for (int i = 0; i < numSigs; i++) {
+		if (!txn_sighash(&txn, sigIndices[i], hash)) {
+			printf("sighash %d failed\n", sigIndices[i]);
+			return 1;
+		}
+		printHash(hash);
+	}
+	// an index that was never requested must not produce a hash
+	if (txn_sighash(&txn, 60000, hash)) {
+		printf("sighash 60000 succeeded\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+# gentxn.py SEED [KWARGS] writes a random Sia-encoded transaction to stdout,
+# and its displayed elements, totals and SigHashes to expect.txt.
+#
+# KWARGS are passed to gen, e.g. "nout=500" or "arb=True,bigsig=True"; or,
+# with "partial=True", the transaction is made by gen_partial instead.
+#
+# gentxn.py compress SLOTS compresses the transaction on stdin for a
+# P2_COMPRESSED upload to a device with SLOTS dictionary slots, as
+# compressTxn in sialedger.go does.
+
+import hashlib, random, struct, sys
+
+def u64(n):
+    return struct.pack('<Q', n)
+
+def cur(v):
+    b = v.to_bytes((v.bit_length() + 7) // 8, 'big') if v else b''
+    return u64(len(b)) + b
+
+def randbytes(n, r):
+    return bytes(r.getrandbits(8) for _ in range(n))
+
+def slice_(xs):
+    return u64(len(xs)) + b''.join(xs)
+
+def unlock_conditions(r, nkeys=None, keylen=32):
+    if nkeys is None:
+        nkeys = r.choice([0, 1, 1, 2, 3])
+    out = u64(r.choice([0, 12345])) + u64(nkeys)
+    for _ in range(nkeys):
+        out += b'ed25519'.ljust(16, b'\0') + u64(keylen) + randbytes(keylen, r)
+    return out + u64(1)
+
+# emptysig leaves the signatures empty, so that the transaction ends with a
+# long run of zeros (the CoveredFields and the signature's length). abridge
+# is a list of sig indices; if given, the transaction is in the form sent
+# with P2_SIG_HEADERS, keeping only the headers of those signatures.
+def gen(seed, nout=None, arb=False, bigkeys=False, bigsig=False, emptysig=False, nsigs=None, abridge=None):
+    r = random.Random(seed)
+    vals = []
+    sci = [randbytes(32, r) + unlock_conditions(r, 20 if bigkeys else None) for _ in range(r.randint(0, 3))]
+    if nout is None:
+        nout = r.randint(0, 5)
+    sco = []
+    for _ in range(nout):
+        v = r.choice([0, 1, 10**24, r.getrandbits(r.randint(1, 144)), 2**144 - 1])
+        h = randbytes(32, r)
+        vals.append(('sc', v, h))
+        sco.append(cur(v) + h)
+    sfi = [randbytes(32, r) + unlock_conditions(r) + randbytes(32, r) for _ in range(r.randint(0, 2))]
+    sfo = []
+    for _ in range(r.randint(0, 2)):
+        v = r.getrandbits(r.randint(1, 64))
+        h = randbytes(32, r)
+        vals.append(('sf', v, h))
+        sfo.append(cur(v) + h + cur(r.getrandbits(20)))
+    fees = []
+    for _ in range(r.randint(0, 2)):
+        v = r.getrandbits(r.randint(1, 100))
+        vals.append(('fee', v, None))
+        fees.append(cur(v))
+    arbs = [u64(n) + randbytes(n, r) for n in ([r.randint(0, 3000)] if arb else [])]
+    if nsigs is None:
+        nsigs = r.randint(1, 3)
+    sigs = []
+    for _ in range(nsigs):
+        slen = 0 if emptysig else 2000 if bigsig else 64
+        covered = b'\x01' + u64(0) * 10 # whole transaction
+        sigs.append(randbytes(32, r) + u64(r.randint(0, 3)) + u64(r.choice([0, 99])) + covered + u64(slen) + randbytes(slen, r))
+
+    # file contracts, revisions and storage proofs are always empty
+    txn = slice_(sci) + slice_(sco) + u64(0) * 3 + slice_(sfi) + slice_(sfo) + slice_(fees) + slice_(arbs)
+    if abridge is None:
+        txn += slice_(sigs)
+    else:
+        txn += u64(len(sigs)) + b''.join(sigs[i][:48] for i in abridge)
+
+    # the sighash covers every field but the signatures, with the replay
+    # prefix before each input, followed by the first 48 bytes of the
+    # signature being made (parent ID, public key index, timelock)
+    hashes = []
+    for s in sigs:
+        h = hashlib.blake2b(digest_size=32)
+        h.update(u64(len(sci)))
+        for x in sci:
+            h.update(b'\x01' + x)
+        h.update(slice_(sco) + u64(0) * 3 + u64(len(sfi)))
+        for x in sfi:
+            h.update(b'\x01' + x)
+        h.update(slice_(sfo) + slice_(fees) + slice_(arbs))
+        h.update(s[:48])
+        hashes.append(h.hexdigest())
+    for a in arbs:
+        vals.append(('arb', int.from_bytes(a[:8], 'little'), a[8:8+32]))
+    return txn, vals, hashes
+
+# gen_partial generates the form of a transaction that is sent with
+# P2_PARTIAL: only the elements covered by a signature whose CoveredFields
+# list them individually, in order, with the slice length prefixes counting
+# only those. Its SigHash is the hash of the covered elements, with the
+# usual replay prefix before each input.
+def gen_partial(seed):
+    r = random.Random(seed)
+    covered = lambda xs: [x for x in xs if r.random() < 0.5]
+    vals = []
+    sci = covered([randbytes(32, r) + unlock_conditions(r) for _ in range(r.randint(0, 4))])
+    sco = []
+    for _ in range(r.randint(0, 5)):
+        v = r.getrandbits(r.randint(1, 144))
+        h = randbytes(32, r)
+        if r.random() < 0.5:
+            vals.append(('sc', v, h))
+            sco.append(cur(v) + h)
+    sfi = covered([randbytes(32, r) + unlock_conditions(r) + randbytes(32, r) for _ in range(r.randint(0, 2))])
+    sfo = []
+    for _ in range(r.randint(0, 2)):
+        v = r.getrandbits(40)
+        h = randbytes(32, r)
+        if r.random() < 0.5:
+            vals.append(('sf', v, h))
+            sfo.append(cur(v) + h + cur(r.getrandbits(20)))
+    fees = []
+    for _ in range(r.randint(0, 2)):
+        v = r.getrandbits(60)
+        if r.random() < 0.5:
+            vals.append(('fee', v, None))
+            fees.append(cur(v))
+    arbs = covered([u64(n) + randbytes(n, r) for n in [r.randint(0, 300)]])
+    def covered_fields():
+        out = bytes([r.choice([0, 1])])
+        for _ in range(10):
+            n = r.randint(0, 3)
+            out += u64(n) + b''.join(u64(r.randint(0, 9)) for _ in range(n))
+        return out
+    sigs = covered([randbytes(32, r) + u64(r.randint(0, 3)) + u64(0) + covered_fields() + u64(64) + randbytes(64, r) for _ in range(r.randint(0, 3))])
+
+    txn = slice_(sci) + slice_(sco) + u64(0) * 3 + slice_(sfi) + slice_(sfo) + slice_(fees) + slice_(arbs) + slice_(sigs)
+    h = hashlib.blake2b(digest_size=32)
+    for x in sci:
+        h.update(b'\x01' + x)
+    h.update(b''.join(sco))
+    for x in sfi:
+        h.update(b'\x01' + x)
+    h.update(b''.join(sfo + fees + arbs + sigs))
+    for a in arbs:
+        vals.append(('arb', int.from_bytes(a[:8], 'little'), a[8:8+32]))
+    return txn, vals, [h.hexdigest()]
+
+# fmt formats a currency value as the device does; zero is the empty string
+def fmt(v):
+    return str(v) if v else ''
+
+def address(h):
+    return h.hex() + hashlib.blake2b(h, digest_size=32).hexdigest()[:12]
+
+def compress(data, slots):
+    widths = [32, 24]
+    counts = {}
+    for w in widths:
+        for i in range(len(data) - w + 1):
+            counts[data[i:i+w]] = counts.get(data[i:i+w], 0) + 1
+    out, lit = bytearray(), bytearray()
+    def flush():
+        for j in range(0, len(lit), 128):
+            out.append(len(lit[j:j+128]) - 1)
+            out.extend(lit[j:j+128])
+        lit.clear()
+    dictionary, next_slot = [None] * slots, 0
+    i = 0
+    while i < len(data):
+        # short runs of zeros are cheaper as part of a literal
+        z = 0
+        while i + z < len(data) and data[i+z] == 0 and z < 64:
+            z += 1
+        if z >= 3:
+            flush()
+            out.append(0x80 + z - 1)
+            i += z
+            continue
+        for w in widths:
+            v = data[i:i+w]
+            if len(v) < w or counts[v] < 2 or not any(v):
+                continue
+            flush()
+            if v in dictionary:
+                out.append(0xE0 + dictionary.index(v))
+            else:
+                out.append(0xC0 + w - 1)
+                out.extend(v)
+                dictionary[next_slot] = v
+                next_slot = (next_slot + 1) % slots
+            i += w
+            break
+        else:
+            lit.append(data[i])
+            i += 1
+    flush()
+    return bytes(out)
+
+if __name__ == '__main__' and sys.argv[1] == 'compress':
+    sys.stdout.buffer.write(compress(sys.stdin.buffer.read(), int(sys.argv[2])))
+elif __name__ == '__main__':
+    seed = int(sys.argv[1])
+    kwargs = eval('dict(' + (sys.argv[2] if len(sys.argv) > 2 else '') + ')')
+    if kwargs.pop('partial', False):
+        txn, vals, hashes = gen_partial(seed, **kwargs)
+    else:
+        txn, vals, hashes = gen(seed, **kwargs)
+    sys.stdout.buffer.write(txn)
+    with open('expect.txt', 'w') as f:
+        for t, v, h in vals:
+            if t == 'arb':
+                f.write('%s %d %s\n' % (t, v, h.hex()))
+            else:
+                f.write('%s %s %s\n' % (t, fmt(v), address(h) if h else '[Miner Fee]'))
+        total = lambda k: fmt(sum(v for t, v, h in vals if t == k))
+        f.write('total %s %s %s\n' % (total('sc'), total('sf'), total('fee')))
+        for x in hashes:
+            f.write('hash %s\n' % x)
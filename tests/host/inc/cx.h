@@ -0,0 +1,31 @@
+// Minimal host stand-in for the BOLOS SDK's cx.h; see tests/host/run.sh.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+typedef struct { uint64_t h[8], t[2], f[2]; uint8_t buf[128]; size_t c, outlen; } cx_blake2b_t;
+typedef cx_blake2b_t cx_hash_t;
+#define CX_LAST 1
+void cx_blake2b_init(cx_blake2b_t *S, int bits);
+int cx_hash(cx_hash_t *S, int mode, const uint8_t *in, size_t len, uint8_t *out, size_t outlen);
+typedef struct { int curve; size_t W_len; uint8_t W[65]; } cx_ecfp_public_key_t;
+typedef struct { int curve; size_t d_len; uint8_t d[64]; } cx_ecfp_private_key_t;
+#define CX_CURVE_Ed25519 1
+#define HDW_ED25519_SLIP10 1
+#define CX_RND_RFC6979 0
+#define CX_SHA512 0
+void cx_ecfp_init_private_key(int c, uint8_t *k, size_t l, cx_ecfp_private_key_t *pk);
+void cx_ecfp_init_public_key(int c, uint8_t *k, size_t l, cx_ecfp_public_key_t *pk);
+void cx_ecfp_generate_pair(int c, cx_ecfp_public_key_t *p, cx_ecfp_private_key_t *k, int x);
+void cx_eddsa_sign(cx_ecfp_private_key_t *k, int m, int h, const uint8_t *hash, size_t hl, void *a, int b, uint8_t *sig, size_t sl, void *c);
+void os_perso_derive_node_bip32_seed_key(int a, int b, uint32_t *p, int l, uint8_t *k, void *x, void *y, int z);
+typedef struct { uint8_t k[16]; } cx_aes_key_t;
+#define CX_ENCRYPT 0x10
+#define CX_CHAIN_ECB 0
+#define CX_PAD_NONE 0
+typedef struct { cx_blake2b_t b; uint8_t key[32]; } cx_hmac_sha256_t;
+typedef cx_hmac_sha256_t cx_hmac_t;
+int cx_aes_init_key(const uint8_t *raw, unsigned int len, cx_aes_key_t *key);
+int cx_aes(const cx_aes_key_t *key, int mode, const uint8_t *in, unsigned int len, uint8_t *out, unsigned int outlen);
+int cx_hmac_sha256_init(cx_hmac_sha256_t *h, const uint8_t *key, unsigned int len);
+int cx_hmac(cx_hmac_t *h, int mode, const uint8_t *in, unsigned int len, uint8_t *mac, unsigned int maclen);
+void cx_rng(uint8_t *buf, unsigned int len);
@@ -0,0 +1,3 @@
+// Minimal host stand-in for the glyphs.h the SDK generates; see tests/host/run.sh.
+// The icons themselves are declared in ux.h.
+#pragma once
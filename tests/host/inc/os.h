@@ -0,0 +1,25 @@
+// Minimal host stand-in for the BOLOS SDK's os.h; see tests/host/run.sh.
+#pragma once
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+typedef struct try_ctx { jmp_buf jb; struct try_ctx *prev; int ex; } try_ctx;
+extern try_ctx *G_try;
+#define BEGIN_TRY { try_ctx __tc; __tc.prev = G_try; G_try = &__tc; __tc.ex = setjmp(__tc.jb);
+#define TRY if (__tc.ex == 0)
+#define CATCH(x) else if (__tc.ex == (x) && (G_try = __tc.prev, 1))
+#define CATCH_OTHER(e) else if ((G_try = __tc.prev, 1)) for (unsigned short e = __tc.ex, __c = 1; __c; __c = 0)
+#define CATCH_ALL else if ((G_try = __tc.prev, 1))
+#define FINALLY G_try = __tc.prev; if (1)
+#define END_TRY G_try = __tc.prev; }
+static inline void __throw(int x) { if (!G_try) { fprintf(stderr, "uncaught %x\n", x); abort(); } longjmp(G_try->jb, x); }
+#define THROW(x) __throw(x)
+#define U4LE(b, o) ((uint32_t)(b)[(o)] | ((uint32_t)(b)[(o)+1] << 8) | ((uint32_t)(b)[(o)+2] << 16) | ((uint32_t)(b)[(o)+3] << 24))
+#define U4BE(b, o) (((uint32_t)(b)[(o)] << 24) | ((uint32_t)(b)[(o)+1] << 16) | ((uint32_t)(b)[(o)+2] << 8) | (uint32_t)(b)[(o)+3])
+#define U2LE(b, o) ((uint16_t)((b)[(o)] | ((b)[(o)+1] << 8)))
+#define U2BE(b, o) ((uint16_t)(((b)[(o)] << 8) | (b)[(o)+1]))
+#define UNUSED(x) (void)(x)
+void os_sched_exit(int exit_code);
+#include "cx.h"
@@ -0,0 +1,35 @@
+// Minimal host stand-in for the BOLOS SDK's os_io_seproxyhal.h; see tests/host/run.sh.
+#pragma once
+#include <os.h>
+#include <stdbool.h>
+#ifndef IO_APDU_BUFFER_SIZE
+#define IO_APDU_BUFFER_SIZE 260
+#endif
+extern unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+#define IO_ASYNCH_REPLY 0x10
+#define IO_RETURN_AFTER_TX 0x20
+#define IO_RESET_AFTER_REPLIED 0x80
+#define IO_FLAGS 0xF8
+#define CHANNEL_APDU 0
+#define CHANNEL_KEYBOARD 1
+#define CHANNEL_SPI 2
+#define EXCEPTION_IO_RESET 0x10
+#define INVALID_PARAMETER 2
+unsigned short io_exchange(unsigned char channel_and_flags, unsigned short tx_len);
+typedef struct { int type; } bagl_element_t;
+typedef struct { int stack_count; } ux_state_t;
+typedef struct { int x; } bolos_ux_params_t;
+extern unsigned char G_io_seproxyhal_spi_buffer[];
+#define IO_SEPROXYHAL_BUFFER_SIZE_B 128
+enum { SEPROXYHAL_TAG_FINGER_EVENT = 1, SEPROXYHAL_TAG_BUTTON_PUSH_EVENT, SEPROXYHAL_TAG_STATUS_EVENT, SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT, SEPROXYHAL_TAG_TICKER_EVENT, IO_APDU_MEDIA_USB_HID, SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED };
+extern int G_io_apdu_media;
+#define UX_FINGER_EVENT(x)
+#define UX_BUTTON_PUSH_EVENT(x)
+#define UX_DEFAULT_EVENT()
+#define UX_DISPLAYED_EVENT(...)
+#define UX_TICKER_EVENT(x, ...)
+#define UX_INIT()
+#define BEGIN_TRY_L(l) BEGIN_TRY
+#define TRY_L(l) TRY
+#define FINALLY_L(l) FINALLY
+#define END_TRY_L(l) END_TRY
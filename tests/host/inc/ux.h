@@ -0,0 +1,11 @@
+// Minimal host stand-in for the BOLOS SDK's ux.h; see tests/host/run.sh.
+#pragma once
+#define UX_STEP_CB(name, layout, cb, ...) static void name##_fn(void) { cb; const void *x[] = __VA_ARGS__; (void)x; } const int name = 0;
+#define UX_STEP_VALID UX_STEP_CB
+#define UX_STEP_NOCB(name, layout, ...) static void name##_fn(void) { const void *x[] = __VA_ARGS__; (void)x; } const int name = 0;
+#define UX_DEF(name, ...) const int *const name[] = { __VA_ARGS__ };
+#define UX_FLOW UX_DEF
+#define FLOW_LOOP ((const int *)0)
+void ux_flow_init(int, const int *const *, void *);
+void ux_stack_push(void);
+extern const int C_icon_validate, C_icon_crossmark, C_icon_back, C_icon_certificate, C_icon_dashboard;
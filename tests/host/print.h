@@ -0,0 +1,37 @@
+// print.h prints decoded elements, totals and SigHashes in the format
+// gentxn.py writes to expect.txt. It is shared by the host programs, and
+// must be included after sia.h.
+
+static const char *elemNames[] = {"sci", "sc", "fc", "fcr", "sp", "sfi", "sf", "fee", "arb", "sig"};
+
+static void printElem(txn_elem_t *elem) {
+	if (elem->type == TXN_ELEM_ARB_DATA) {
+		uint8_t hex[65];
+		bin2hex(hex, elem->arb.preview, elem->arb.len < 32 ? elem->arb.len : 32);
+		printf("arb %llu %s\n", (unsigned long long)elem->arb.len, hex);
+		return;
+	}
+	uint8_t val[80];
+	cur_t c = {0};
+	cur_add(&c, elem->out.val, elem->out.valLen);
+	cur_fmt(val, &c);
+	uint8_t addr[77] = "[Miner Fee]";
+	if (elem->type != TXN_ELEM_MINER_FEE) {
+		unlockHashToSiaAddress(addr, elem->out.hash);
+	}
+	printf("%s %s %s\n", elemNames[elem->type], val, addr);
+}
+
+static void printTotals(txn_state_t *txn) {
+	uint8_t sc[80], sf[80], fee[80];
+	cur_fmt(sc, &txn->scTotal);
+	cur_fmt(sf, &txn->sfTotal);
+	cur_fmt(fee, &txn->feeTotal);
+	printf("total %s %s %s\n", sc, sf, fee);
+}
+
+static void printHash(uint8_t *hash) {
+	uint8_t hex[65];
+	bin2hex(hex, hash, 32);
+	printf("hash %s\n", hex);
+}
@@ -0,0 +1,217 @@
+#!/bin/bash
+# run.sh builds parts of the app on the host, against the stand-in SDK headers
+# in inc/ and the stubs in sdk_stubs.c, and runs the checks and benchmarks
+# below. gcc and python3 are required.
+#
+# Usage: tests/host/run.sh [bench | CHECK...]
+#
+# With no arguments, every check is run.
+#
+# Checks:
+#   decode     random transactions from gentxn.py, fed to the decoder in
+#              255-, 17- and 1-byte chunks, with the rest of each chunk's
+#              buffer poisoned; the displayed elements, totals and SigHashes
+#              must match (N seeds each, default 150); repeated with
+#              elements larger than the decoder's buffer (UnlockConditions
+#              with 20 keys, 2000-byte signatures), and with ArbitraryData
+#              of up to 3000 bytes; and in TXN_MODE_SIG_HEADERS, with only
+#              the requested signatures' headers sent (twice: as is, and
+#              with large elements); and in TXN_MODE_PARTIAL, with only
+#              the elements covered by a partial signature sent
+#   calc       handleCalcTxnHash, driven by calc.c through whole sessions
+#              on the transactions of the decode check, for both targets: the
+#              reviewed elements (or totals) and SigHashes must match, when
+#              displaying, signing, summarizing, and hashing only; repeated
+#              with each transaction compressed (see gentxn.py), and with
+#              compressed transactions that end in a long run of zeros,
+#              and with P2_SIG_HEADERS and P2_PARTIAL, both plain and
+#              compressed;
+#              then the scenarios in calc.c, which interrupt sessions: a
+#              command sent while a reply is deferred must drop the
+#              transaction, and a token import abandoned part-way must not
+#              block the next transaction
+#   apdu       sia_main's framing of short and extended-length request APDUs,
+#              with the Nano S's APDU buffer and the Nano X's; a length
+#              longer than the data received must be rejected with 0x6700
+#   cur        cur_fmt against the baseline cur2dec (cur2dec_old.inc) for
+#              every value length, powers of ten, and zero
+#
+# Benchmarks:
+#   bench_txn  a 500-output transaction from gentxn.py, decoded 300 times in
+#              255-byte chunks: displayed elements per second, and bytes
+#              copied into the decoder's buffer per transaction; repeated
+#              with BLAKE2b stubbed out (blake2b_null.c), to measure the
+#              decoder alone
+#   bench_cur  cur_fmt and the baseline cur2dec, timed per value length (in
+#              cycles on x86-64, nanoseconds elsewhere)
+#
+# The benchmark figures in the history of src/ come from these programs, as
+# the median of 5 runs on an x86-64 host. The "before" figures come from
+# building the same programs against src/ at the parent commit, adjusting
+# them to that commit's API where it differs. For the circular buffer, the
+# bytes moved by advance() were counted by adding the memmove length to
+# bytesCopied in the parent's advance().
+
+set -e
+HOST=$(cd "$(dirname "$0")" && pwd)
+SRC="$HOST/../../src"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+CFLAGS="-O2 -Wall -Wno-unused-function -Wno-unused-variable -Wno-unused-but-set-variable -I$HOST/inc -I$SRC"
+DECODER="$SRC/txn.c $SRC/currency.c $SRC/sia.c $SRC/token.c $SRC/expand.c $HOST/sdk_stubs.c"
+
+# build NAME SOURCES... compiles a program into $OUT.
+build() {
+	local name=$1
+	shift
+	gcc $CFLAGS -o "$OUT/$name" "$@"
+}
+
+# gen_seed SEED KWARGS [h] writes transaction SEED, generated with the given
+# gentxn.py arguments, to txn.bin, and picks the SigHashes to request: a
+# single one for even seeds, all of them for odd ones. It sets $sigs, and
+# writes the expected SigHashes to hashes.txt. With h, txn.bin holds only
+# the headers of the requested signatures, as sent with P2_SIG_HEADERS.
+gen_seed() {
+	python3 "$HOST/gentxn.py" "$1" "$2" > txn.bin
+	local nh=$(grep -c ^hash expect.txt) lines
+	if [ $(($1 % 2)) = 0 ]; then
+		sigs=$(($1 % nh)); lines="$((sigs+1))p"
+	else
+		sigs=$(seq -s, 0 $((nh-1))); lines="p"
+	fi
+	grep ^hash expect.txt | sed -n "$lines" > hashes.txt
+	if [ "$3" = h ]; then
+		python3 "$HOST/gentxn.py" "$1" "${2:+$2,}abridge=($sigs,)" > txn.bin
+	fi
+}
+
+# decode_seeds KWARGS [h|p] runs the decode check on N transactions generated
+# with the given gentxn.py arguments, in TXN_MODE_SIG_HEADERS with h, or
+# TXN_MODE_PARTIAL with p (for which KWARGS should include partial=True).
+decode_seeds() {
+	local fail=0
+	for seed in $(seq 1 "${N:-150}"); do
+		gen_seed $seed "$1" "$2"
+		{ grep -v ^hash expect.txt; cat hashes.txt; } > want.txt
+		for chunk in 255 17 1; do
+			if ! ./decode $chunk "$sigs" $2 < txn.bin > got.txt 2>&1 || ! cmp -s got.txt want.txt; then
+				echo "FAIL decode seed=$seed kwargs=$1 mode=$2 chunk=$chunk"
+				diff got.txt want.txt | head -5
+				fail=1
+			fi
+		done
+	done
+	return $fail
+}
+
+# calc_seeds KWARGS [FLAGS] runs calc sessions on N transactions, as
+# decode_seeds does, for each target and with each of the P2 flags below,
+# combined with FLAGS. With P2_COMPRESSED (0x20) in FLAGS, each transaction
+# is compressed for the target's dictionary; with P2_SIG_HEADERS (0x40), it
+# is abridged. With P2_PARTIAL (0x80), KWARGS should include partial=True.
+calc_seeds() {
+	local fail=0 flags=${2:-0}
+	for seed in $(seq 1 "${N:-150}"); do
+		gen_seed $seed "$1" $([ $((flags & 0x40)) != 0 ] && echo h)
+		for calc in calc calc_s; do
+			local in=txn.bin
+			if [ $((flags & 0x20)) != 0 ]; then
+				python3 "$HOST/gentxn.py" compress $([ $calc = calc ] && echo 8 || echo 4) < txn.bin > txn.z
+				in=txn.z
+			fi
+			for p2 in 0 1 4 8; do
+				# when not signing, the SigHashes are sent before the
+				# totals are shown
+				case $p2 in
+				0|1) grep -E '^(sc|sf|fee|arb) ' expect.txt; cat hashes.txt ;;
+				4) cat hashes.txt; grep ^total expect.txt ;;
+				8) cat hashes.txt ;;
+				esac > want.txt
+				for chunk in 255 17 1; do
+					if ! ./$calc $chunk "$sigs" $((p2 | flags)) < $in > got.txt 2>&1 || ! cmp -s got.txt want.txt; then
+						echo "FAIL $calc seed=$seed kwargs=$1 p2=$((p2 | flags)) chunk=$chunk"
+						diff got.txt want.txt | head -5
+						fail=1
+					fi
+				done
+			done
+		done
+	done
+	return $fail
+}
+
+check_decode() {
+	build decode "$HOST/decode.c" $DECODER "$SRC/blake2b.c"
+	cd "$OUT"
+	decode_seeds "" &&
+	decode_seeds "bigkeys=True,bigsig=True" &&
+	decode_seeds "arb=True" &&
+	decode_seeds "" h &&
+	decode_seeds "bigkeys=True,bigsig=True" h &&
+	decode_seeds "partial=True" p
+}
+
+check_calc() {
+	build calc "$HOST/calc.c" $DECODER "$SRC/blake2b.c"
+	build calc_s -DTARGET_NANOS "$HOST/calc.c" $DECODER "$SRC/blake2b.c"
+	cd "$OUT"
+	calc_seeds "" &&
+	calc_seeds "" 0x20 &&
+	calc_seeds "bigkeys=True,emptysig=True" 0x20 &&
+	calc_seeds "" 0x40 &&
+	calc_seeds "" 0x60 &&
+	calc_seeds "partial=True" 0x80 &&
+	calc_seeds "partial=True" 0xA0 || return 1
+	python3 "$HOST/gentxn.py" 1 nout=20 > txn.bin
+	./calc scenarios 0 < txn.bin && ./calc_s scenarios 0 < txn.bin
+}
+
+check_apdu() {
+	sed '/^\/\/ Everything below this point is Ledger magic/,$d' "$SRC/main.c" > "$OUT/main_top.c"
+	build apdu_short -I"$OUT" -DAPPVERSION='"0.0.0"' "$HOST/apdu.c" "$HOST/sdk_stubs.c"
+	build apdu_ext -I"$OUT" -DAPPVERSION='"0.0.0"' -DIO_APDU_BUFFER_SIZE=2055 "$HOST/apdu.c" "$HOST/sdk_stubs.c"
+	"$OUT/apdu_short" && "$OUT/apdu_ext"
+}
+
+check_cur() {
+	build bench_cur "$HOST/bench_cur.c" $DECODER "$SRC/blake2b.c"
+	"$OUT/bench_cur" > "$OUT/cur.txt" || { cat "$OUT/cur.txt"; return 1; }
+}
+
+bench() {
+	build bench_txn "$HOST/bench_txn.c" $DECODER "$SRC/blake2b.c"
+	cd "$OUT"
+	python3 "$HOST/gentxn.py" 1 nout=500 > big.bin
+	echo "bench_txn:"
+	./bench_txn 300 < big.bin
+	build bench_txn_nohash "$HOST/bench_txn.c" $DECODER "$HOST/blake2b_null.c"
+	echo "bench_txn (BLAKE2b stubbed):"
+	./bench_txn_nohash 300 < big.bin
+	build bench_cur "$HOST/bench_cur.c" $DECODER "$SRC/blake2b.c"
+	echo "bench_cur:"
+	./bench_cur time
+}
+
+CHECKS="decode calc apdu cur"
+
+case "$1" in
+bench)
+	bench
+	;;
+-h|--help)
+	sed -n '2,/^$/s/^# \{0,1\}//p' "$0"
+	;;
+*)
+	fail=0
+	for check in ${@:-$CHECKS}; do
+		if (check_$check); then
+			echo "$check: ok"
+		else
+			fail=1
+		fi
+	done
+	exit $fail
+	;;
+esac
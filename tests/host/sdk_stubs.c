@@ -0,0 +1,165 @@
+// Host implementations of the BOLOS SDK calls used by the decoder sources.
+// cx_hash is a plain reference BLAKE2b, so transaction hashes are real; key
+// derivation, signing, AES, HMAC and the RNG are deterministic placeholders.
+
+#include <os.h>
+
+try_ctx *G_try;
+
+static const uint64_t IV[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t SIGMA[12][16] = {
+	{ 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+	{14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+	{11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+	{ 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+	{ 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+	{ 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+	{12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+	{13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+	{ 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+	{10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0},
+	{ 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+	{14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+};
+
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define G(a, b, c, d, x, y) do { \
+	a = a + b + x; d = ROTR64(d ^ a, 32); \
+	c = c + d;     b = ROTR64(b ^ c, 24); \
+	a = a + b + y; d = ROTR64(d ^ a, 16); \
+	c = c + d;     b = ROTR64(b ^ c, 63); \
+} while (0)
+
+static void compress(cx_blake2b_t *S, const uint8_t *block, int last) {
+	uint64_t m[16], v[16];
+	for (int i = 0; i < 16; i++) {
+		m[i] = 0;
+		for (int j = 7; j >= 0; j--) {
+			m[i] = (m[i] << 8) | block[i*8 + j];
+		}
+	}
+	for (int i = 0; i < 8; i++) {
+		v[i] = S->h[i];
+		v[i+8] = IV[i];
+	}
+	v[12] ^= S->t[0];
+	v[13] ^= S->t[1];
+	if (last) {
+		v[14] = ~v[14];
+	}
+	for (int r = 0; r < 12; r++) {
+		const uint8_t *s = SIGMA[r];
+		G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+		G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+		G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+		G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+		G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+		G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+		G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+		G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+	}
+	for (int i = 0; i < 8; i++) {
+		S->h[i] ^= v[i] ^ v[i+8];
+	}
+}
+
+void cx_blake2b_init(cx_blake2b_t *S, int bits) {
+	memset(S, 0, sizeof(*S));
+	S->outlen = bits / 8;
+	for (int i = 0; i < 8; i++) {
+		S->h[i] = IV[i];
+	}
+	S->h[0] ^= 0x01010000 ^ S->outlen;
+}
+
+int cx_hash(cx_hash_t *S, int mode, const uint8_t *in, size_t len, uint8_t *out, size_t outlen) {
+	for (size_t i = 0; i < len; i++) {
+		if (S->c == 128) {
+			S->t[0] += 128;
+			if (S->t[0] < 128) {
+				S->t[1]++;
+			}
+			compress(S, S->buf, 0);
+			S->c = 0;
+		}
+		S->buf[S->c++] = in[i];
+	}
+	if (mode & CX_LAST) {
+		S->t[0] += S->c;
+		if (S->t[0] < S->c) {
+			S->t[1]++;
+		}
+		while (S->c < 128) {
+			S->buf[S->c++] = 0;
+		}
+		compress(S, S->buf, 1);
+		for (size_t i = 0; i < S->outlen && i < outlen; i++) {
+			out[i] = (S->h[i/8] >> (8*(i%8))) & 0xFF;
+		}
+	}
+	return 0;
+}
+
+void os_perso_derive_node_bip32_seed_key(int a, int b, uint32_t *path, int pathLen, uint8_t *key, void *x, void *y, int z) {
+	// make the key depend on the index, so that mixing up keys is visible
+	memset(key, 0, 32);
+	memcpy(key, &path[2], sizeof(path[2]));
+}
+
+void cx_ecfp_init_private_key(int curve, uint8_t *raw, size_t len, cx_ecfp_private_key_t *pk) {
+	memset(pk, 0, sizeof(*pk));
+	memcpy(pk->d, raw, len < sizeof(pk->d) ? len : sizeof(pk->d));
+}
+
+void cx_ecfp_init_public_key(int curve, uint8_t *raw, size_t len, cx_ecfp_public_key_t *pk) {
+	memset(pk, 0, sizeof(*pk));
+}
+
+void cx_ecfp_generate_pair(int curve, cx_ecfp_public_key_t *pub, cx_ecfp_private_key_t *priv, int keep) {
+	for (int i = 0; i < 65; i++) {
+		pub->W[i] = priv->d[i % 4] + i*7;
+	}
+}
+
+void cx_eddsa_sign(cx_ecfp_private_key_t *priv, int mode, int hashID, const uint8_t *hash, size_t hashLen, void *ctx, int ctxLen, uint8_t *sig, size_t sigLen, void *info) {
+	memset(sig, 0, sigLen);
+	memcpy(sig, priv->d, 4);
+	memcpy(sig+32, hash, hashLen < sigLen-32 ? hashLen : sigLen-32);
+}
+
+// AES, HMAC and the RNG are keyed, deterministic stand-ins built on BLAKE2b.
+// They are not the real primitives, but they round-trip, which is all the
+// host checks need.
+
+int cx_aes_init_key(const uint8_t *raw, unsigned int len, cx_aes_key_t *key) {
+	memcpy(key->k, raw, 16);
+	return 0;
+}
+
+int cx_aes(const cx_aes_key_t *key, int mode, const uint8_t *in, unsigned int len, uint8_t *out, unsigned int outlen) {
+	cx_blake2b_t S;
+	cx_blake2b_init(&S, 128);
+	cx_hash((cx_hash_t *)&S, 0, key->k, 16, NULL, 0);
+	cx_hash((cx_hash_t *)&S, CX_LAST, in, 16, out, 16);
+	return 16;
+}
+
+int cx_hmac_sha256_init(cx_hmac_sha256_t *h, const uint8_t *key, unsigned int len) {
+	cx_blake2b_init(&h->b, 256);
+	cx_hash((cx_hash_t *)&h->b, 0, key, len, NULL, 0);
+	return 0;
+}
+
+int cx_hmac(cx_hmac_t *h, int mode, const uint8_t *in, unsigned int len, uint8_t *mac, unsigned int maclen) {
+	return cx_hash((cx_hash_t *)&h->b, mode, in, len, mac, maclen);
+}
+
+void cx_rng(uint8_t *buf, unsigned int len) {
+	for (unsigned int i = 0; i < len; i++) {
+		buf[i] = rand();
+	}
+}